@@ -0,0 +1,185 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "batch.h"
+#include "image.h"
+#include "pool.h"
+#include "util.h"
+
+// how many finished images may wait to be written per thread
+#define IN_FLIGHT_PER_THREAD (2)
+
+struct result {
+	char *data;
+	size_t size;
+	bool done, ok;
+};
+
+struct batch {
+	char **files;
+	struct batch_options *options;
+	struct result *results;
+	size_t next_write;  // next result to write to stdout, so the output order is always the input order
+	size_t max_pending; // bound on results held in memory
+	bool failed;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static bool render_file(char *filename, struct batch_options *options, char **data, size_t *size) {
+	// renders an image into a newly allocated buffer, without a terminal
+	SDL_Surface *surface = load_file(filename, options->load);
+	if (!surface) return false;
+
+	bool ret = false;
+	FILE *out = open_memstream(data, size);
+	if (!out) {
+		warn("open_memstream");
+	} else {
+		ret = render_surface(surface, &options->render, out);
+		if (!ret) eprintf("%s: Failed to render image\n", filename);
+		fclose(out); // updates data and size
+		if (!ret) {
+			free(*data);
+			*data = NULL;
+		}
+	}
+	free_surface(surface);
+	return ret;
+}
+
+static char *output_name(char *filename) {
+	// the name of the file in the output directory, without .ans
+	char *base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	return strcmp(base, "-") == 0 ? "stdin" : base;
+}
+
+static int compare_output_names(const void *a, const void *b) {
+	return strcmp(output_name(*(char *const *) a), output_name(*(char *const *) b));
+}
+
+static bool unique_output_names(char **files, size_t count) {
+	// files with the same name in different directories would overwrite each other's output
+	char **sorted = malloc(sizeof(char *) * count);
+	if (!sorted) {
+		warn("malloc");
+		return false;
+	}
+	memcpy(sorted, files, sizeof(char *) * count);
+	qsort(sorted, count, sizeof(char *), compare_output_names);
+
+	bool ret = true;
+	for (size_t i = 1; i < count; ++i) {
+		if (compare_output_names(&sorted[i - 1], &sorted[i]) == 0) {
+			eprintf("%s and %s would both be written to %s.ans\n", sorted[i - 1], sorted[i], output_name(sorted[i]));
+			ret = false;
+		}
+	}
+	free(sorted);
+	return ret;
+}
+
+static bool write_output(char *filename, struct batch_options *options, char *data, size_t size) {
+	// write to <output_dir>/<file name>.ans
+	char *base = output_name(filename);
+
+	char *path = malloc(strlen(options->output_dir) + strlen(base) + 6);
+	if (!path) {
+		warn("malloc");
+		return false;
+	}
+	sprintf(path, "%s/%s.ans", options->output_dir, base);
+
+	bool ret = false;
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		warn("%s", path);
+	} else {
+		ret = fwrite(data, 1, size, fp) == size;
+		if (fclose(fp) != 0) ret = false;
+		if (!ret) warn("%s", path);
+	}
+	free(path);
+	return ret;
+}
+
+static void batch_job(size_t index, void *data) {
+	struct batch *batch = data;
+	struct batch_options *options = batch->options;
+
+	if (!options->output_dir) {
+		// wait until there is room, so finished images can't pile up behind a slow one
+		pthread_mutex_lock(&batch->mutex);
+		while (index >= batch->next_write + batch->max_pending)
+			pthread_cond_wait(&batch->cond, &batch->mutex);
+		pthread_mutex_unlock(&batch->mutex);
+	}
+
+	char *out = NULL;
+	size_t size = 0;
+	bool ok = render_file(batch->files[index], options, &out, &size);
+
+	if (options->output_dir) {
+		if (ok) ok = write_output(batch->files[index], options, out, size);
+		free(out);
+		if (!ok) {
+			pthread_mutex_lock(&batch->mutex);
+			batch->failed = true;
+			pthread_mutex_unlock(&batch->mutex);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&batch->mutex);
+	batch->results[index] = (struct result){.data = out, .size = size, .done = true, .ok = ok};
+	if (!ok) batch->failed = true;
+
+	// whichever thread finishes the next image in order writes out everything that is ready
+	while (batch->results[batch->next_write].done) {
+		struct result *result = &batch->results[batch->next_write];
+		if (result->ok && fwrite(result->data, 1, result->size, stdout) != result->size) {
+			warn("stdout");
+			batch->failed = true;
+		}
+		free(result->data);
+		result->data = NULL;
+		++batch->next_write;
+	}
+	fflush(stdout);
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+bool run_batch(char **files, size_t count, struct batch_options *options) {
+	// renders every file and writes it to stdout in order, or to its own file in output_dir
+	struct batch batch = {
+	        .files = files,
+	        .options = options,
+	        .max_pending = (size_t) options->threads * IN_FLIGHT_PER_THREAD,
+	};
+
+	if (options->output_dir && !unique_output_names(files, count)) return false;
+
+	// one more slot than files, so the write loop always stops at an unfinished result
+	batch.results = calloc(count + 1, sizeof(struct result));
+	if (!batch.results) {
+		warn("calloc");
+		return false;
+	}
+
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	if (!pool_run(count, options->threads, batch_job, &batch)) batch.failed = true;
+
+	pthread_cond_destroy(&batch.cond);
+	pthread_mutex_destroy(&batch.mutex);
+	free(batch.results);
+	return !batch.failed;
+}
@@ -0,0 +1,16 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "term.h"
+#include "image.h"
+
+struct batch_options {
+	struct render_options render;
+	struct load_options *load;
+	char *output_dir; // NULL to write everything to stdout
+	unsigned int threads;
+};
+
+bool run_batch(char **files, size_t count, struct batch_options *options);
+#endif // BATCH_H
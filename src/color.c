@@ -1,4 +1,12 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <pthread.h>
+
 #include "color.h"
+#include "arg.h"
+#include "util.h"
 
 #define SQ(x) ((x) * (x))
 
@@ -17,53 +25,187 @@ size_t closest_color(struct color color, struct color *color_table, size_t color
 
 #define VAL(n) ((n) == 0 ? 0 : 40 * (n) + 55) // 0, 95, 135, 175, 215, 255
 
+static struct color color_table_8bit[240];
+static pthread_once_t color_table_8bit_once = PTHREAD_ONCE_INIT;
+
+static void init_8bit_table() {
+	struct color *color_table = color_table_8bit;
+	uint8_t i = 0;
+	struct color color;
+	color.a = 0xff;
+
+	// fill colors (6^3)
+	for (color.r = 0; color.r < 6; ++color.r)
+		for (color.g = 0; color.g < 6; ++color.g)
+			for (color.b = 0; color.b < 6; ++color.b, ++i) {
+				color_table[i] = (struct color){
+				        .r = VAL(color.r),
+				        .g = VAL(color.g),
+				        .b = VAL(color.b),
+				};
+			}
+	// fill grayscale (24)
+	for (color.r = 8; color.r < 238; color.r += 10, ++i) {
+		color.b = color.g = color.r;
+		color_table[i] = color;
+	}
+}
+
 uint8_t rgb_to_8bit(struct color color) {
-	static struct color color_table[240];
-	static bool color_table_init = false;
-	if (!color_table_init) {
-		color_table_init = true;
-		uint8_t i = 0;
-		struct color color;
-		color.a = 0xff;
-
-		// fill colors (6^3)
-		for (color.r = 0; color.r < 6; ++color.r)
-			for (color.g = 0; color.g < 6; ++color.g)
-				for (color.b = 0; color.b < 6; ++color.b, ++i) {
-					color_table[i] = (struct color){
-					        .r = VAL(color.r),
-					        .g = VAL(color.g),
-					        .b = VAL(color.b),
-					};
+	// the table is shared between threads in batch mode
+	pthread_once(&color_table_8bit_once, init_8bit_table);
+
+	// find closest color (16-255)
+	return closest_color(color, color_table_8bit, 240) + 16;
+}
+
+void default_palette(struct palette *palette) {
+	struct color *color_table = palette->colors;
+	for (uint8_t i = 0; i < 16; ++i) {
+		color_table[i] = (struct color){.a = 0xff};
+		uint8_t n = (i & 0x8) ? 0xff : 0x80;
+		// dynamically generate color table
+		color_table[i].r = (i & 0x1) ? n : 0x00;
+		color_table[i].g = (i & 0x2) ? n : 0x00;
+		color_table[i].b = (i & 0x4) ? n : 0x00;
+	};
+	color_table[8] = color_table[7];
+	color_table[7] = (struct color){{{0xc0, 0xc0, 0xc0, 0xff}}};
+}
+
+#define GRID_SHIFT (8 - PALETTE_GRID_BITS)
+#define GRID_INDEX(r, g, b) ((((r) >> GRID_SHIFT) << (PALETTE_GRID_BITS * 2)) | (((g) >> GRID_SHIFT) << PALETTE_GRID_BITS) | ((b) >> GRID_SHIFT))
+
+static uint32_t box_dist(int value, int low, bool farthest) {
+	// squared distance along one channel from a color to the nearest or farthest value in [low, low + cell size)
+	int high = low + (1 << GRID_SHIFT) - 1;
+	if (farthest) return (uint32_t) SQ(value - low > high - value ? value - low : high - value);
+	if (value < low) return (uint32_t) SQ(low - value);
+	if (value > high) return (uint32_t) SQ(value - high);
+	return 0;
+}
+
+void build_palette_index(struct palette *palette) {
+	// a color can only be the closest to something in a cell if its nearest point there is no farther than
+	// the farthest point of some other color, as that one is at most that far from every point in the cell
+	// so the cells keep those candidates, and lookups only compare the few of them, with the exact result
+	for (int r = 0; r < 256; r += 1 << GRID_SHIFT)
+		for (int g = 0; g < 256; g += 1 << GRID_SHIFT)
+			for (int b = 0; b < 256; b += 1 << GRID_SHIFT) {
+				uint32_t near[16], bound = UINT32_MAX;
+				for (int i = 0; i < 16; ++i) {
+					struct color c = palette->colors[i];
+					near[i] = box_dist(c.r, r, false) + box_dist(c.g, g, false) + box_dist(c.b, b, false);
+					uint32_t far = box_dist(c.r, r, true) + box_dist(c.g, g, true) + box_dist(c.b, b, true);
+					if (far < bound) bound = far;
 				}
-		// fill grayscale (24)
-		for (color.r = 8; color.r < 238; color.r += 10, ++i) {
-			color.b = color.g = color.r;
-			color_table[i] = color;
+				uint16_t candidates = 0;
+				for (int i = 0; i < 16; ++i)
+					if (near[i] <= bound) candidates |= (uint16_t) (1 << i);
+				palette->grid[GRID_INDEX(r, g, b)] = candidates;
+			}
+}
+
+uint8_t palette_lookup(struct palette *palette, struct color color) {
+	// the same result as closest_color, ties go to the lowest index
+	uint16_t candidates = palette->grid[GRID_INDEX(color.r, color.g, color.b)];
+	uint8_t closest = 0;
+	uint32_t closest_dist = UINT32_MAX;
+	for (int i = 0; candidates; ++i, candidates >>= 1) {
+		if (!(candidates & 1)) continue;
+		struct color c = palette->colors[i];
+		uint32_t dist = SQ(color.r - c.r) + SQ(color.g - c.g) + SQ(color.b - c.b);
+		if (dist < closest_dist) {
+			closest = (uint8_t) i;
+			closest_dist = dist;
 		}
 	}
+	return closest;
+}
 
-	// find closest color (16-255)
-	return closest_color(color, color_table, 240) + 16;
+static struct palette palette_4bit;
+static pthread_once_t palette_4bit_once = PTHREAD_ONCE_INIT;
+
+static void init_4bit_palette() {
+	default_palette(&palette_4bit);
+	build_palette_index(&palette_4bit);
 }
 
 uint8_t rgb_to_4bit(struct color color) {
-	static struct color color_table[16];
-	static bool color_table_init = false;
-	if (!color_table_init) {
-		color_table_init = true;
-		for (uint8_t i = 0; i < 16; ++i) {
-			color_table[i] = (struct color){.a = 0xff};
-			uint8_t n = (i & 0x8) ? 0xff : 0x80;
-			// dynamically generate color table
-			color_table[i].r = (i & 0x1) ? n : 0x00;
-			color_table[i].g = (i & 0x2) ? n : 0x00;
-			color_table[i].b = (i & 0x4) ? n : 0x00;
-		};
-		color_table[8] = color_table[7];
-		color_table[7] = (struct color){{{0xc0, 0xc0, 0xc0, 0xff}}};
-	}
+	pthread_once(&palette_4bit_once, init_4bit_palette);
 
 	// find closest color (0-15)
-	return closest_color(color, color_table, 16);
+	return palette_lookup(&palette_4bit, color);
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+bool parse_color(char *str, struct color *color) {
+	// parses either #rrggbb, rrggbb or r,g,b
+	if (*str == '#') ++str;
+	if (strlen(str) == 6) {
+		uint8_t channels[3];
+		bool hex = true;
+		for (int i = 0; i < 3 && hex; ++i) {
+			int hi = hex_digit(str[i * 2]), lo = hex_digit(str[i * 2 + 1]);
+			if (hi < 0 || lo < 0) hex = false;
+			else
+				channels[i] = (uint8_t) (hi << 4 | lo);
+		}
+		if (hex) {
+			*color = (struct color){{{channels[0], channels[1], channels[2], 0xff}}};
+			return true;
+		}
+	}
+
+	long nums[3];
+	SDL_Color sdl_color;
+	if (!parse_num_array(str, nums, 3)) return false;
+	if (!to_color(nums[0], nums[1], nums[2], &sdl_color)) return false;
+	*color = (struct color){{{sdl_color.r, sdl_color.g, sdl_color.b, 0xff}}};
+	return true;
+}
+
+bool read_palette_file(char *filename, struct palette *palette) {
+	// one color per line for indices 0-15, missing entries keep their current value
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		warn("%s", filename);
+		return false;
+	}
+
+	char line[256];
+	size_t i = 0, line_num = 0;
+	bool ret = true;
+	while (i < 16 && fgets(line, sizeof(line), fp)) {
+		++line_num;
+		// strip whitespace
+		char *start = line;
+		while (isspace((unsigned char) *start)) ++start;
+		char *end = start + strlen(start);
+		while (end > start && isspace((unsigned char) end[-1])) --end;
+		*end = '\0';
+
+		// skip empty lines and comments
+		if (!*start || *start == ';') continue;
+
+		if (!parse_color(start, &palette->colors[i])) {
+			eprintf("%s:%zu: Invalid color\n", filename, line_num);
+			ret = false;
+			break;
+		}
+		++i;
+	}
+
+	if (ferror(fp)) {
+		warn("%s", filename);
+		ret = false;
+	}
+	fclose(fp);
+	return ret;
 }
@@ -14,8 +14,23 @@ struct color {
 	};
 };
 
+// bits per channel of the grid narrowing down which colors can be the closest
+#define PALETTE_GRID_BITS (5)
+#define PALETTE_GRID_LEN (1 << (PALETTE_GRID_BITS * 3))
+
+struct palette {
+	struct color colors[16];
+	uint16_t grid[PALETTE_GRID_LEN]; // bit i is set if color i is the closest to any rgb value in that cell
+};
+
 size_t closest_color(struct color color, struct color *color_table, size_t color_len);
 uint8_t rgb_to_8bit(struct color color);
 uint8_t rgb_to_4bit(struct color color);
 
+void default_palette(struct palette *palette);
+void build_palette_index(struct palette *palette);
+uint8_t palette_lookup(struct palette *palette, struct color color);
+bool read_palette_file(char *filename, struct palette *palette);
+bool parse_color(char *str, struct color *color);
+
 #endif
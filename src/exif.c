@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "exif.h"
+
+#define TAG_ORIENTATION (0x0112)
+#define TAG_IMAGE_WIDTH (0x0100)
+#define TAG_IMAGE_LENGTH (0x0101)
+#define TAG_THUMBNAIL_OFFSET (0x0201)
+#define TAG_THUMBNAIL_LENGTH (0x0202)
+
+// the tiff structure exif data is stored in
+struct tiff {
+	const uint8_t *data;
+	size_t size;
+	bool big_endian;
+};
+
+static uint16_t get_u16(struct tiff *tiff, size_t offset) {
+	const uint8_t *p = tiff->data + offset;
+	return tiff->big_endian ? (uint16_t) (p[0] << 8 | p[1]) : (uint16_t) (p[1] << 8 | p[0]);
+}
+
+static uint32_t get_u32(struct tiff *tiff, size_t offset) {
+	const uint8_t *p = tiff->data + offset;
+	return tiff->big_endian ? (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3]
+	                        : (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
+
+static bool open_tiff(const uint8_t *data, size_t size, struct tiff *tiff) {
+	if (size < 8) return false;
+	if (memcmp(data, "II*\0", 4) == 0) *tiff = (struct tiff){data, size, false};
+	else if (memcmp(data, "MM\0*", 4) == 0)
+		*tiff = (struct tiff){data, size, true};
+	else
+		return false;
+	return true;
+}
+
+static bool find_tag(struct tiff *tiff, uint32_t ifd, uint16_t tag, size_t *entry) {
+	// finds an entry in an ifd, entry is set to the offset of its value
+	if (ifd < 8 || (size_t) ifd + 2 > tiff->size) return false;
+	uint16_t count = get_u16(tiff, ifd);
+	for (uint16_t i = 0; i < count; ++i) {
+		size_t offset = ifd + 2 + (size_t) i * 12;
+		if (offset + 12 > tiff->size) return false;
+		if (get_u16(tiff, offset) == tag) {
+			*entry = offset + 8;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool find_exif(const uint8_t *data, size_t size, struct tiff *tiff) {
+	// jpeg: the APP1 segment starting with Exif\0\0
+	if (size >= 4 && data[0] == 0xff && data[1] == 0xd8) {
+		size_t offset = 2;
+		while (offset + 4 <= size && data[offset] == 0xff) {
+			uint8_t marker = data[offset + 1];
+			if (marker == 0xda || marker == 0xd9) break; // image data starts, no more metadata
+			size_t len = (size_t) data[offset + 2] << 8 | data[offset + 3];
+			if (len < 2 || offset + 2 + len > size) break;
+			if (marker == 0xe1 && len >= 8 && memcmp(data + offset + 4, "Exif\0\0", 6) == 0)
+				return open_tiff(data + offset + 10, len - 8, tiff);
+			offset += 2 + len;
+		}
+		return false;
+	}
+
+	// png: the eXIf chunk, which must come before the image data
+	if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) {
+		for (size_t offset = 8; offset + 8 <= size;) {
+			size_t len = (size_t) data[offset] << 24 | (size_t) data[offset + 1] << 16 | (size_t) data[offset + 2] << 8 | data[offset + 3];
+			if (len > size - offset - 8) break;
+			if (memcmp(data + offset + 4, "eXIf", 4) == 0) return open_tiff(data + offset + 8, len, tiff);
+			if (memcmp(data + offset + 4, "IDAT", 4) == 0) break;
+			offset += len + 12;
+		}
+		return false;
+	}
+
+	// webp: the EXIF chunk in the riff container
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
+		for (size_t offset = 12; offset + 8 <= size;) {
+			size_t len = (size_t) data[offset + 7] << 24 | (size_t) data[offset + 6] << 16 | (size_t) data[offset + 5] << 8 | data[offset + 4];
+			if (len > size - offset - 8) break;
+			if (memcmp(data + offset, "EXIF", 4) == 0) {
+				// some writers keep the Exif\0\0 prefix from jpeg
+				if (len >= 6 && memcmp(data + offset + 8, "Exif\0\0", 6) == 0) return open_tiff(data + offset + 14, len - 6, tiff);
+				return open_tiff(data + offset + 8, len, tiff);
+			}
+			offset += 8 + len + (len & 1);
+		}
+	}
+
+	// tiff files are left alone, SDL_image already reads them upright
+	return false;
+}
+
+enum orientation exif_orientation(const uint8_t *data, size_t size) {
+	struct tiff tiff;
+	size_t entry;
+	if (!find_exif(data, size, &tiff)) return ORIENTATION_NORMAL;
+	if (!find_tag(&tiff, get_u32(&tiff, 4), TAG_ORIENTATION, &entry)) return ORIENTATION_NORMAL;
+
+	uint16_t orientation = get_u16(&tiff, entry);
+	if (orientation < ORIENTATION_NORMAL || orientation > ORIENTATION_ROTATE_270) return ORIENTATION_NORMAL;
+	return (enum orientation) orientation;
+}
+
+bool exif_thumbnail(const uint8_t *data, size_t size, const uint8_t **thumbnail, size_t *thumbnail_size) {
+	// the thumbnail is a jpeg pointed to by the second ifd, in the exif data or a tiff file itself
+	struct tiff tiff;
+	size_t offset_entry, length_entry;
+	if (!find_exif(data, size, &tiff) && !open_tiff(data, size, &tiff)) return false;
+
+	uint32_t ifd0 = get_u32(&tiff, 4);
+	if (ifd0 < 8 || (size_t) ifd0 + 2 > tiff.size) return false;
+	size_t next = ifd0 + 2 + (size_t) get_u16(&tiff, ifd0) * 12;
+	if (next + 4 > tiff.size) return false;
+	uint32_t ifd1 = get_u32(&tiff, next);
+
+	if (!find_tag(&tiff, ifd1, TAG_THUMBNAIL_OFFSET, &offset_entry)) return false;
+	if (!find_tag(&tiff, ifd1, TAG_THUMBNAIL_LENGTH, &length_entry)) return false;
+	uint32_t offset = get_u32(&tiff, offset_entry), length = get_u32(&tiff, length_entry);
+	if (length < 4 || offset > tiff.size || length > tiff.size - offset) return false;
+	if (tiff.data[offset] != 0xff || tiff.data[offset + 1] != 0xd8) return false;
+
+	*thumbnail = tiff.data + offset;
+	*thumbnail_size = length;
+	return true;
+}
+
+static bool tiff_value(struct tiff *tiff, size_t entry, int *value) {
+	// a SHORT or LONG value of an entry
+	uint16_t type = get_u16(tiff, entry - 6);
+	if (type == 3) *value = get_u16(tiff, entry);
+	else if (type == 4 && get_u32(tiff, entry) <= INT32_MAX)
+		*value = (int) get_u32(tiff, entry);
+	else
+		return false;
+	return *value > 0;
+}
+
+static bool jpeg_size(const uint8_t *data, size_t size, int *w, int *h) {
+	// reads the size from the start of frame header, without decoding anything
+	size_t offset = 2;
+	while (offset + 4 <= size && data[offset] == 0xff) {
+		uint8_t marker = data[offset + 1];
+		if (marker == 0xff) {
+			// padding
+			++offset;
+			continue;
+		}
+		if (marker == 0xda || marker == 0xd9) break;
+		size_t len = (size_t) data[offset + 2] << 8 | data[offset + 3];
+		if (len < 2) break;
+		// every SOFn, but not DHT, JPG and DAC which share the range
+		if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+			if (len < 7 || offset + 9 > size) break;
+			*h = data[offset + 5] << 8 | data[offset + 6];
+			*w = data[offset + 7] << 8 | data[offset + 8];
+			return *w > 0 && *h > 0;
+		}
+		offset += 2 + len;
+	}
+	return false;
+}
+
+bool header_size(const uint8_t *data, size_t size, int *w, int *h) {
+	// the size of a jpeg or tiff image from the start of the file, for the formats thumbnails are read from
+	if (size >= 4 && data[0] == 0xff && data[1] == 0xd8) return jpeg_size(data, size, w, h);
+
+	struct tiff tiff;
+	size_t entry;
+	if (!open_tiff(data, size, &tiff)) return false;
+	uint32_t ifd0 = get_u32(&tiff, 4);
+	if (!find_tag(&tiff, ifd0, TAG_IMAGE_WIDTH, &entry) || !tiff_value(&tiff, entry, w)) return false;
+	if (!find_tag(&tiff, ifd0, TAG_IMAGE_LENGTH, &entry) || !tiff_value(&tiff, entry, h)) return false;
+	return true;
+}
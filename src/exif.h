@@ -0,0 +1,25 @@
+#ifndef EXIF_H
+#define EXIF_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// values of the orientation tag, how the stored pixels have to be transformed to be shown upright
+enum orientation {
+	ORIENTATION_NORMAL = 1,
+	ORIENTATION_FLIP_H,
+	ORIENTATION_ROTATE_180,
+	ORIENTATION_FLIP_V,
+	ORIENTATION_TRANSPOSE,
+	ORIENTATION_ROTATE_90,
+	ORIENTATION_TRANSVERSE,
+	ORIENTATION_ROTATE_270
+};
+
+// whether width and height are swapped when shown
+#define ORIENTATION_SWAPS(o) ((o) >= ORIENTATION_TRANSPOSE)
+
+enum orientation exif_orientation(const uint8_t *data, size_t size);
+bool exif_thumbnail(const uint8_t *data, size_t size, const uint8_t **thumbnail, size_t *thumbnail_size);
+bool header_size(const uint8_t *data, size_t size, int *w, int *h);
+#endif // EXIF_H
@@ -0,0 +1,154 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "foto.h"
+#include "image.h"
+#include "term.h"
+#include "util.h"
+
+struct foto_image {
+	SDL_Surface *surface;
+};
+
+struct foto_renderer {
+	struct render_options options;
+	struct palette palette;
+};
+
+static struct foto_image *wrap_surface(SDL_Surface *surface) {
+	if (!surface) return NULL;
+	struct foto_image *image = malloc(sizeof(struct foto_image));
+	if (!image) {
+		warn("malloc");
+		free_surface(surface);
+		return NULL;
+	}
+	image->surface = surface;
+	return image;
+}
+
+unsigned int foto_api_version(void) {
+	return FOTO_API_VERSION;
+}
+
+struct foto_image *foto_image_decode(const void *data, size_t size) {
+	if (!data || size >= INT32_MAX) return NULL;
+	return wrap_surface(decode_image(data, size, NULL));
+}
+
+struct foto_image *foto_image_open(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		warn("%s", filename);
+		return NULL;
+	}
+	SDL_Surface *surface = read_file(fp, NULL);
+	fclose(fp);
+	return wrap_surface(surface);
+}
+
+struct foto_image *foto_image_from_pixels(const void *pixels, int w, int h, int pitch, enum foto_pixel_format format) {
+	static const Uint32 formats[] = {
+	        [FOTO_PIXEL_RGB] = SDL_PIXELFORMAT_RGB24,
+	        [FOTO_PIXEL_BGR] = SDL_PIXELFORMAT_BGR24,
+	        [FOTO_PIXEL_RGBA] = SDL_PIXELFORMAT_RGBA32,
+	        [FOTO_PIXEL_BGRA] = SDL_PIXELFORMAT_BGRA32,
+	        [FOTO_PIXEL_ARGB] = SDL_PIXELFORMAT_ARGB32,
+	        [FOTO_PIXEL_ABGR] = SDL_PIXELFORMAT_ABGR32,
+	};
+	if (!pixels || w <= 0 || h <= 0 || (size_t) format >= sizeof(formats) / sizeof(formats[0])) return NULL;
+	Uint32 sdl_format = formats[format];
+	if (pitch < w * (int) SDL_BYTESPERPIXEL(sdl_format)) return NULL;
+
+	// the surface only borrows the pixels, and never writes to them
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom((void *) pixels, w, h, SDL_BITSPERPIXEL(sdl_format), pitch, sdl_format);
+	if (!surface) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		return NULL;
+	}
+	return wrap_surface(surface);
+}
+
+void foto_image_size(const struct foto_image *image, int *w, int *h) {
+	SDL_Point size = oriented_size((SDL_Point){image->surface->w, image->surface->h}, surface_orientation(image->surface));
+	if (w) *w = size.x;
+	if (h) *h = size.y;
+}
+
+void foto_image_free(struct foto_image *image) {
+	if (!image) return;
+	free_surface(image->surface);
+	free(image);
+}
+
+struct foto_rect foto_fit(int image_w, int image_h, int box_w, int box_h) {
+	SDL_Rect rect = get_fit_mode((SDL_Point){image_w, image_h}, (SDL_Point){box_w, box_h});
+	return (struct foto_rect){.x = rect.x, .y = rect.y, .w = rect.w, .h = rect.h};
+}
+
+struct foto_renderer *foto_renderer_new(const struct foto_render_options *options) {
+	static const enum bit_depth depths[] = {
+	        [FOTO_COLOR_4BIT] = BIT_4,
+	        [FOTO_COLOR_8BIT] = BIT_8,
+	        [FOTO_COLOR_24BIT] = BIT_24,
+	};
+	static const enum glyph_mode glyphs[] = {
+	        [FOTO_GLYPHS_HALF] = GLYPH_HALF,
+	        [FOTO_GLYPHS_QUADRANT] = GLYPH_QUADRANT,
+	        [FOTO_GLYPHS_SEXTANT] = GLYPH_SEXTANT,
+	};
+	if (!options || options->cols <= 0 || options->rows <= 0 || (size_t) options->depth >= sizeof(depths) / sizeof(depths[0])) return NULL;
+	if (options->unicode && (size_t) options->glyphs >= sizeof(glyphs) / sizeof(glyphs[0])) return NULL;
+
+	struct foto_renderer *renderer = malloc(sizeof(struct foto_renderer));
+	if (!renderer) {
+		warn("malloc");
+		return NULL;
+	}
+
+	// building the lookup table is the slow part, so it is only done once here
+	default_palette(&renderer->palette);
+	if (options->palette)
+		for (int i = 0; i < 16; ++i)
+			renderer->palette.colors[i] = (struct color){{{options->palette[i][0], options->palette[i][1], options->palette[i][2], 0xff}}};
+	build_palette_index(&renderer->palette);
+
+	renderer->options = (struct render_options){
+	        .size = {options->cols, options->rows},
+	        .background = {options->background[0], options->background[1], options->background[2], 255},
+	        .glyphs = options->unicode ? glyphs[options->glyphs] : GLYPH_SPACE,
+	        .stretch = options->stretch,
+	        .bit_depth = depths[options->depth],
+	        .palette = &renderer->palette,
+	};
+	return renderer;
+}
+
+void foto_renderer_free(struct foto_renderer *renderer) {
+	free(renderer);
+}
+
+size_t foto_render(const struct foto_renderer *renderer, const struct foto_image *image, char *buf, size_t size) {
+	char *data = NULL;
+	size_t data_size = 0;
+	FILE *out = open_memstream(&data, &data_size);
+	if (!out) {
+		warn("open_memstream");
+		return 0;
+	}
+
+	// the options are only read, they aren't const so they can be shared with the rest of foto
+	struct render_options options = renderer->options;
+	bool ok = render_surface(image->surface, &options, out);
+	fclose(out); // updates data and data_size
+
+	size_t ret = ok ? data_size : 0;
+	// a partial escape sequence is worse than nothing, so it's all or nothing
+	if (ok && buf && data_size <= size) memcpy(buf, data, data_size);
+	free(data);
+	return ret;
+}
@@ -0,0 +1,95 @@
+#ifndef FOTO_H
+#define FOTO_H
+// public API of libfoto, for showing image previews in a terminal without running foto
+// nothing here uses global state, so separate images and renderers can be used from separate threads
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define FOTO_API __attribute__((visibility("default")))
+#else
+#define FOTO_API
+#endif
+
+// bumped whenever anything in this file changes incompatibly
+#define FOTO_API_VERSION (2)
+
+struct foto_image;
+struct foto_renderer;
+
+// byte order of pixels in memory
+enum foto_pixel_format {
+	FOTO_PIXEL_RGB,
+	FOTO_PIXEL_BGR,
+	FOTO_PIXEL_RGBA,
+	FOTO_PIXEL_BGRA,
+	FOTO_PIXEL_ARGB,
+	FOTO_PIXEL_ABGR
+};
+
+enum foto_color_depth {
+	FOTO_COLOR_4BIT,  // the 16 colors of the palette
+	FOTO_COLOR_8BIT,  // the 256 color cube and grays
+	FOTO_COLOR_24BIT // true color
+};
+
+// the block characters unicode output uses, more pixels per cell need a font with more of them
+enum foto_glyphs {
+	FOTO_GLYPHS_HALF,     // 1x2 pixels per cell
+	FOTO_GLYPHS_QUADRANT, // 2x2 pixels per cell
+	FOTO_GLYPHS_SEXTANT   // 2x3 pixels per cell, needs Unicode 13
+};
+
+struct foto_rect {
+	int x, y, w, h;
+};
+
+struct foto_render_options {
+	int cols, rows;             // size of the output in cells
+	bool unicode;               // more than one pixel per cell using block characters
+	enum foto_glyphs glyphs;    // which ones, when unicode is set
+	bool stretch;               // fill the cells instead of keeping the aspect ratio
+	enum foto_color_depth depth;
+	uint8_t background[3];      // rgb shown around the image and behind transparency
+	const uint8_t (*palette)[3]; // the 16 colors for 4-bit depth, NULL for the defaults
+};
+
+// the FOTO_API_VERSION the library was built with
+FOTO_API unsigned int foto_api_version(void);
+
+// decode an image in any format foto supports, data is only read and can be freed afterwards
+FOTO_API struct foto_image *foto_image_decode(const void *data, size_t size);
+
+// read and decode an image file
+FOTO_API struct foto_image *foto_image_open(const char *filename);
+
+// use uncompressed pixels as an image without copying them, they have to stay valid until foto_image_free
+FOTO_API struct foto_image *foto_image_from_pixels(const void *pixels, int w, int h, int pitch, enum foto_pixel_format format);
+
+// size of the image as it is shown, after EXIF orientation
+FOTO_API void foto_image_size(const struct foto_image *image, int *w, int *h);
+
+FOTO_API void foto_image_free(struct foto_image *image);
+
+// the largest rect with the aspect ratio of the image that fits in the box, centered in it
+FOTO_API struct foto_rect foto_fit(int image_w, int image_h, int box_w, int box_h);
+
+// set up everything that can be reused between images, such as the palette lookup table
+FOTO_API struct foto_renderer *foto_renderer_new(const struct foto_render_options *options);
+
+FOTO_API void foto_renderer_free(struct foto_renderer *renderer);
+
+// render an image as text with ANSI escapes into buf, one line per row of cells
+// returns how many bytes the output is, and only writes it if that is no more than size
+// so a call with a NULL buf and 0 size finds the size needed, 0 if rendering failed
+FOTO_API size_t foto_render(const struct foto_renderer *renderer, const struct foto_image *image, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // FOTO_H
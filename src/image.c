@@ -1,12 +1,20 @@
 #include <err.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
 #include "util.h"
 #include "image.h"
+#include "exif.h"
+#include "region.h"
+#include "parallel.h"
 
 // get file pointer from filename
 FILE *open_file(char *filename) {
@@ -28,13 +36,171 @@ void close_file(FILE *fp) {
 	}
 }
 
-// get surface from file pointer
-SDL_Surface *read_file(FILE *fp) {
-	if (!fp) {
-		eprintf("Failed to open file\n");
+// pixel formats accepted by --raw, byte order names are the order in memory
+static const struct {
+	char *name;
+	Uint32 format;
+} raw_formats[] = {
+        {"rgb",      SDL_PIXELFORMAT_RGB24   },
+        {"bgr",      SDL_PIXELFORMAT_BGR24   },
+        {"rgba",     SDL_PIXELFORMAT_RGBA32  },
+        {"bgra",     SDL_PIXELFORMAT_BGRA32  },
+        {"argb",     SDL_PIXELFORMAT_ARGB32  },
+        {"abgr",     SDL_PIXELFORMAT_ABGR32  },
+        {"rgb565",   SDL_PIXELFORMAT_RGB565  },
+        {"rgb888",   SDL_PIXELFORMAT_RGB888  },
+        {"rgba8888", SDL_PIXELFORMAT_RGBA8888},
+        {"argb8888", SDL_PIXELFORMAT_ARGB8888},
+        {"abgr8888", SDL_PIXELFORMAT_ABGR8888},
+        {"bgra8888", SDL_PIXELFORMAT_BGRA8888},
+};
+
+bool parse_raw_format(char *str, struct raw_format *raw) {
+	// parses [w]x[h]:[format]
+	char *end;
+	errno = 0;
+	long w = strtol(str, &end, 10);
+	if (errno != 0 || end == str || *end != 'x' || w <= 0 || w > INT16_MAX) return false;
+	str = end + 1;
+	long h = strtol(str, &end, 10);
+	if (errno != 0 || end == str || *end != ':' || h <= 0 || h > INT16_MAX) return false;
+	str = end + 1;
+
+	for (size_t i = 0; i < sizeof(raw_formats) / sizeof(raw_formats[0]); ++i) {
+		if (strcasecmp(str, raw_formats[i].name) == 0) {
+			*raw = (struct raw_format){.w = (int) w, .h = (int) h, .format = raw_formats[i].format};
+			return true;
+		}
+	}
+	return false;
+}
+
+// kept with the surface in userdata, released by free_surface
+struct image_data {
+	void *data; // memory the pixels point into, if not owned by the surface
+	size_t size;
+	bool mapped;
+	enum orientation orientation;
+};
+
+static void free_data(void *data, size_t size, bool mapped) {
+	if (mapped) munmap(data, size);
+	else
+		free(data);
+}
+
+static SDL_Surface *wrap_raw(void *data, size_t size, bool mapped, struct raw_format *raw, SDL_Rect *crop) {
+	// uses the data as the pixels of the surface directly, takes ownership of data
+	int bytes = SDL_BYTESPERPIXEL(raw->format);
+	size_t pitch = (size_t) raw->w * bytes;
+	if (size < pitch * raw->h) {
+		eprintf("Raw image data is too small, expected %zu bytes, got %zu\n", pitch * raw->h, size);
+		free_data(data, size, mapped);
+		return NULL;
+	}
+
+	// a crop of raw pixels is the same buffer starting further in, with the full pitch
+	SDL_Rect rect = {0, 0, raw->w, raw->h};
+	if (crop) {
+		rect = *crop;
+		if (!clip_region(&rect, raw->w, raw->h)) {
+			free_data(data, size, mapped);
+			return NULL;
+		}
+	}
+	uint8_t *pixels = (uint8_t *) data + rect.y * pitch + (size_t) rect.x * bytes;
+
+	struct image_data *image_data = malloc(sizeof(struct image_data));
+	if (!image_data) {
+		warn("malloc");
+		free_data(data, size, mapped);
+		return NULL;
+	}
+	*image_data = (struct image_data){.data = data, .size = size, .mapped = mapped, .orientation = ORIENTATION_NORMAL};
+
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, rect.w, rect.h, SDL_BITSPERPIXEL(raw->format), (int) pitch, raw->format);
+	if (!surface) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		free(image_data);
+		free_data(data, size, mapped);
+		return NULL;
+	}
+	surface->userdata = image_data;
+	return surface;
+}
+
+static SDL_Surface *attach_orientation(SDL_Surface *surface, const void *data, size_t size) {
+	// the pixels aren't rotated here, it's applied when the image is drawn
+	enum orientation orientation = exif_orientation(data, size);
+	if (orientation != ORIENTATION_NORMAL) {
+		struct image_data *image_data = malloc(sizeof(struct image_data));
+		if (!image_data) {
+			warn("malloc");
+			SDL_FreeSurface(surface);
+			return NULL;
+		}
+		*image_data = (struct image_data){.orientation = orientation};
+		surface->userdata = image_data;
+	}
+
+	return surface;
+}
+
+static SDL_Surface *decode_crop(const void *data, size_t size, SDL_Rect *crop) {
+	// some codecs can skip the parts outside of the region, the rest are decoded whole and copied from
+	SDL_Surface *surface = decode_region(data, size, crop);
+	if (surface) return surface;
+
+	SDL_RWops *rw = SDL_RWFromConstMem(data, (int) size);
+	if (!rw) {
+		eprintf("Failed to read image: %s\n", SDL_GetError());
+		return NULL;
+	}
+	SDL_Surface *full = IMG_Load_RW(rw, 0);
+	SDL_RWclose(rw);
+	if (!full) {
+		eprintf("Failed to read image: %s\n", IMG_GetError());
 		return NULL;
 	}
 
+	surface = crop_surface(full, crop);
+	SDL_FreeSurface(full);
+	return surface;
+}
+
+// decode an encoded image, data is only read and can be freed afterwards
+SDL_Surface *decode_image(const void *data, size_t size, struct load_options *load) {
+	if (load && load->crop) {
+		SDL_Surface *surface = decode_crop(data, size, load->crop);
+		if (!surface) return NULL;
+		return attach_orientation(surface, data, size);
+	}
+
+	// large images in formats made of independent parts are decoded on every core
+	SDL_Surface *surface = decode_parallel(data, size, load ? load->threads : 0);
+	if (surface) return attach_orientation(surface, data, size);
+
+	SDL_RWops *rw = SDL_RWFromConstMem(data, (int) size);
+
+	if (!rw) {
+		eprintf("Failed to read image: %s\n", SDL_GetError());
+		return NULL;
+	}
+
+	surface = IMG_Load_RW(rw, 0);
+
+	SDL_RWclose(rw);
+
+	if (!surface) {
+		eprintf("Failed to read image: %s\n", IMG_GetError());
+		return NULL;
+	}
+
+	return attach_orientation(surface, data, size);
+}
+
+// read everything from a file pointer into a malloc'd buffer
+uint8_t *read_bytes(FILE *fp, size_t *out_size) {
 	// read the file manually, because SDL can't read from stdin
 	uint8_t *data = NULL;
 	size_t read, size = 0, alloc = 1024;
@@ -70,23 +236,265 @@ SDL_Surface *read_file(FILE *fp) {
 		eprintf("Error reading file\n");
 	}
 
-	SDL_RWops *rw = SDL_RWFromMem(data, (int) size);
+	*out_size = size;
+	return data;
+}
 
-	if (!rw) {
-		free(data);
-		eprintf("Failed to read image: %s\n", SDL_GetError());
+// get surface from file pointer
+SDL_Surface *read_file(FILE *fp, struct load_options *load) {
+	if (!fp) {
+		eprintf("Failed to open file\n");
 		return NULL;
 	}
 
-	SDL_Surface *surface = IMG_Load_RW(rw, 0);
+	size_t size;
+	uint8_t *data = read_bytes(fp, &size);
+	if (!data) return NULL;
+	return read_data(data, size, load);
+}
 
-	SDL_RWclose(rw);
+// get surface from a malloc'd buffer, takes ownership of data
+SDL_Surface *read_data(void *data, size_t size, struct load_options *load) {
+	// raw pixels need no decoding, the buffer becomes the surface
+	if (load && load->raw) return wrap_raw(data, size, false, load->raw, load->crop);
+
+	SDL_Surface *surface = decode_image(data, size, load);
 	free(data);
+	return surface;
+}
 
-	if (!surface) {
-		eprintf("Failed to read image: %s\n", IMG_GetError());
+// get surface from an inherited file descriptor, such as a memfd or shared memory
+SDL_Surface *read_fd(int fd, struct load_options *load) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		warn("fd %d", fd);
 		return NULL;
 	}
 
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0) {
+		// pipes and the like can't be mapped, read them instead
+		int fd_copy = dup(fd);
+		if (fd_copy < 0) {
+			warn("fd %d", fd);
+			return NULL;
+		}
+		FILE *fp = fdopen(fd_copy, "rb");
+		if (!fp) {
+			warn("fd %d", fd);
+			close(fd_copy);
+			return NULL;
+		}
+		SDL_Surface *surface = read_file(fp, load);
+		fclose(fp);
+		return surface;
+	}
+
+	if ((uintmax_t) st.st_size >= INT32_MAX) {
+		eprintf("File is too large\n");
+		return NULL;
+	}
+
+	// a private mapping shares the producer's pages, and is only copied if something writes to it
+	size_t size = (size_t) st.st_size;
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		warn("mmap");
+		return NULL;
+	}
+
+	if (load && load->raw) return wrap_raw(data, size, true, load->raw, load->crop);
+
+	SDL_Surface *surface = decode_image(data, size, load);
+	munmap(data, size);
 	return surface;
 }
+
+SDL_Surface *load_file(char *filename, struct load_options *load) {
+	FILE *fp = open_file(filename);
+	if (!fp) return NULL;
+	SDL_Surface *surface = read_file(fp, load);
+	close_file(fp);
+	return surface;
+}
+
+SDL_Surface *load_thumbnail(char *filename, SDL_Point *size) {
+	// the thumbnail embedded in the metadata at the start of the file, with size set to that of the full image
+	struct stat st;
+	if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < THUMBNAIL_MIN_FILE) return NULL;
+
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return NULL;
+	uint8_t *head = malloc(THUMBNAIL_HEAD);
+	if (!head) {
+		warn("malloc");
+		fclose(fp);
+		return NULL;
+	}
+	size_t head_size = fread(head, 1, THUMBNAIL_HEAD, fp);
+	fclose(fp);
+
+	SDL_Surface *surface = NULL;
+	const uint8_t *thumbnail;
+	size_t thumbnail_size;
+	if (header_size(head, head_size, &size->x, &size->y) && exif_thumbnail(head, head_size, &thumbnail, &thumbnail_size)) {
+		SDL_RWops *rw = SDL_RWFromConstMem(thumbnail, (int) thumbnail_size);
+		if (rw) {
+			surface = IMG_Load_RW(rw, 0);
+			SDL_RWclose(rw);
+		}
+		if (surface) {
+			// thumbnails are often letterboxed to 4:3, only keep the part with the shape of the image so it isn't stretched
+			SDL_Rect rect = get_fit_mode(*size, (SDL_Point){surface->w, surface->h});
+			if (rect.w > 0 && rect.h > 0 && (rect.w < surface->w || rect.h < surface->h)) {
+				SDL_Surface *cropped = crop_surface(surface, &rect);
+				SDL_FreeSurface(surface);
+				surface = cropped;
+			}
+		}
+		// the thumbnail is stored the same way round as the image
+		if (surface) surface = attach_orientation(surface, head, head_size);
+	}
+	free(head);
+	return surface;
+}
+
+void free_surface(SDL_Surface *surface) {
+	// also releases memory the pixels were borrowed from
+	struct image_data *image_data = surface->userdata;
+	SDL_FreeSurface(surface);
+	if (image_data) {
+		if (image_data->data) free_data(image_data->data, image_data->size, image_data->mapped);
+		free(image_data);
+	}
+}
+
+enum orientation surface_orientation(SDL_Surface *surface) {
+	struct image_data *image_data = surface->userdata;
+	return image_data ? image_data->orientation : ORIENTATION_NORMAL;
+}
+
+SDL_Point oriented_size(SDL_Point size, enum orientation orientation) {
+	// size of the image when shown upright
+	if (ORIENTATION_SWAPS(orientation)) return (SDL_Point){size.y, size.x};
+	return size;
+}
+
+// tile size for orient_surface, 32x32 pixels of 4 bytes keeps both the source and destination tile in L1
+#define ORIENT_TILE (32)
+
+SDL_Surface *orient_surface(SDL_Surface *surface, enum orientation orientation) {
+	// get an upright copy of a surface
+	SDL_Surface *src = surface;
+	if (src->format->format != SDL_PIXELFORMAT_ARGB8888) {
+		src = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+		if (!src) {
+			eprintf("Failed to convert surface: %s\n", SDL_GetError());
+			return NULL;
+		}
+	}
+
+	int w = src->w, h = src->h;
+	SDL_Point size = oriented_size((SDL_Point){w, h}, orientation);
+	SDL_Surface *dst = SDL_CreateRGBSurfaceWithFormat(0, size.x, size.y, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!dst) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		if (src != surface) SDL_FreeSurface(src);
+		return NULL;
+	}
+
+	// every orientation maps (x, y) to an offset of base + x * step_x + y * step_y in the destination
+	ptrdiff_t pitch = dst->pitch / 4, base, step_x, step_y;
+	switch (orientation) {
+		default:
+		case ORIENTATION_NORMAL: base = 0, step_x = 1, step_y = pitch; break;
+		case ORIENTATION_FLIP_H: base = w - 1, step_x = -1, step_y = pitch; break;
+		case ORIENTATION_ROTATE_180: base = (h - 1) * pitch + w - 1, step_x = -1, step_y = -pitch; break;
+		case ORIENTATION_FLIP_V: base = (h - 1) * pitch, step_x = 1, step_y = -pitch; break;
+		case ORIENTATION_TRANSPOSE: base = 0, step_x = pitch, step_y = 1; break;
+		case ORIENTATION_ROTATE_90: base = h - 1, step_x = pitch, step_y = -1; break;
+		case ORIENTATION_TRANSVERSE: base = (w - 1) * pitch + h - 1, step_x = -pitch, step_y = -1; break;
+		case ORIENTATION_ROTATE_270: base = (w - 1) * pitch, step_x = -pitch, step_y = 1; break;
+	}
+
+	// go through the image in tiles, so rotations don't touch a new cache line for every pixel
+	Uint32 *out = (Uint32 *) dst->pixels + base;
+	for (int ty = 0; ty < h; ty += ORIENT_TILE) {
+		int y_end = ty + ORIENT_TILE < h ? ty + ORIENT_TILE : h;
+		for (int tx = 0; tx < w; tx += ORIENT_TILE) {
+			int x_end = tx + ORIENT_TILE < w ? tx + ORIENT_TILE : w;
+			for (int y = ty; y < y_end; ++y) {
+				const Uint32 *in = (const Uint32 *) ((const Uint8 *) src->pixels + (size_t) y * src->pitch);
+				Uint32 *row = out + y * step_y;
+				for (int x = tx; x < x_end; ++x) row[x * step_x] = in[x];
+			}
+		}
+	}
+
+	if (src != surface) SDL_FreeSurface(src);
+	return dst;
+}
+
+// get a scaled copy of a surface
+SDL_Surface *scale_surface(SDL_Surface *surface, int w, int h) {
+	SDL_Surface *scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!scaled) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		return NULL;
+	}
+
+	// copy the pixels as they are, including alpha
+	SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+	if (SDL_BlitScaled(surface, NULL, scaled, NULL) != 0) {
+		eprintf("Failed to scale surface: %s\n", SDL_GetError());
+		SDL_FreeSurface(scaled);
+		return NULL;
+	}
+	return scaled;
+}
+
+// get a scaled copy of a surface that is upright, w and h are the upright size
+SDL_Surface *scale_upright(SDL_Surface *surface, int w, int h) {
+	enum orientation orientation = surface_orientation(surface);
+	if (orientation == ORIENTATION_NORMAL) return scale_surface(surface, w, h);
+
+	// scale first, so only the small copy has to be rotated
+	SDL_Point size = oriented_size((SDL_Point){w, h}, orientation);
+	SDL_Surface *scaled = scale_surface(surface, size.x, size.y);
+	if (!scaled) return NULL;
+	SDL_Surface *upright = orient_surface(scaled, orientation);
+	SDL_FreeSurface(scaled);
+	return upright;
+}
+
+SDL_Rect texture_rect(SDL_Rect rect, enum orientation orientation) {
+	// the rect to draw the texture in before it is rotated upright around its top left corner
+	if (!ORIENTATION_SWAPS(orientation)) return rect;
+	return (SDL_Rect){.x = rect.x, .y = rect.y, .w = rect.h, .h = rect.w};
+}
+
+int draw_oriented(SDL_Renderer *renderer, SDL_Texture *texture, SDL_Rect rect, enum orientation orientation) {
+	// the renderer rotates and flips the texture, so the pixels themselves never have to be moved
+	static const struct {
+		double angle;
+		SDL_RendererFlip flip;
+	} transforms[] = {
+	        [ORIENTATION_NORMAL]     = {0,   SDL_FLIP_NONE      },
+	        [ORIENTATION_FLIP_H]     = {0,   SDL_FLIP_HORIZONTAL},
+	        [ORIENTATION_ROTATE_180] = {180, SDL_FLIP_NONE      },
+	        [ORIENTATION_FLIP_V]     = {0,   SDL_FLIP_VERTICAL  },
+	        [ORIENTATION_TRANSPOSE]  = {270, SDL_FLIP_HORIZONTAL},
+	        [ORIENTATION_ROTATE_90]  = {90,  SDL_FLIP_NONE      },
+	        [ORIENTATION_TRANSVERSE] = {90,  SDL_FLIP_HORIZONTAL},
+	        [ORIENTATION_ROTATE_270] = {270, SDL_FLIP_NONE      },
+	};
+
+	SDL_Rect dst = texture_rect(rect, orientation);
+	if (orientation == ORIENTATION_NORMAL) return SDL_RenderCopy(renderer, texture, NULL, &dst);
+
+	// turned around its top left corner, which is moved so it lands on rect
+	// around the center it would be half a pixel out whenever the width and height differ by an odd number
+	double angle = transforms[orientation].angle;
+	if (angle == 90 || angle == 180) dst.x += rect.w;
+	if (angle == 180 || angle == 270) dst.y += rect.h;
+	return SDL_RenderCopyEx(renderer, texture, NULL, &dst, angle, &(SDL_Point){0, 0}, transforms[orientation].flip);
+}
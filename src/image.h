@@ -1,7 +1,59 @@
+#ifndef IMAGE_H
+#define IMAGE_H
 #include <stdio.h>
+#include <stdbool.h>
+#include "exif.h"
+
+struct raw_format {
+	int w, h;
+	Uint32 format;
+};
+
+// how files are turned into surfaces, NULL fields are the defaults
+struct load_options {
+	struct raw_format *raw; // the files are raw pixels of this format, otherwise images
+	SDL_Rect *crop;         // only this part of the image is decoded
+	unsigned int threads;   // to decode one image with, 0 for every core
+};
+
+bool parse_raw_format(char *str, struct raw_format *raw);
 
 FILE *open_file(char *filename);
 
 void close_file(FILE *fp);
 
-SDL_Surface *read_file(FILE *fp);
+SDL_Surface *decode_image(const void *data, size_t size, struct load_options *load);
+
+uint8_t *read_bytes(FILE *fp, size_t *size);
+
+SDL_Surface *read_file(FILE *fp, struct load_options *load);
+
+SDL_Surface *read_data(void *data, size_t size, struct load_options *load);
+
+SDL_Surface *read_fd(int fd, struct load_options *load);
+
+SDL_Surface *load_file(char *filename, struct load_options *load);
+
+// files smaller than this decode fast enough without showing the thumbnail first
+#define THUMBNAIL_MIN_FILE (2 << 20)
+// how much of the file is read looking for the thumbnail, exif data in a jpeg is at most 64 KiB
+#define THUMBNAIL_HEAD (256 << 10)
+
+SDL_Surface *load_thumbnail(char *filename, SDL_Point *size);
+
+void free_surface(SDL_Surface *surface);
+
+enum orientation surface_orientation(SDL_Surface *surface);
+
+SDL_Point oriented_size(SDL_Point size, enum orientation orientation);
+
+SDL_Surface *orient_surface(SDL_Surface *surface, enum orientation orientation);
+
+SDL_Surface *scale_upright(SDL_Surface *surface, int w, int h);
+
+SDL_Rect texture_rect(SDL_Rect rect, enum orientation orientation);
+
+int draw_oriented(SDL_Renderer *renderer, SDL_Texture *texture, SDL_Rect rect, enum orientation orientation);
+
+SDL_Surface *scale_surface(SDL_Surface *surface, int w, int h);
+#endif // IMAGE_H
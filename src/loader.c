@@ -0,0 +1,62 @@
+#include <SDL2/SDL.h>
+
+#include "loader.h"
+#include "util.h"
+
+static int loader_thread(void *data) {
+	struct loader *loader = data;
+	SDL_Surface *surface = load_file(loader->filename, loader->load);
+
+	if (SDL_AtomicGet(&loader->cancel)) {
+		// nobody is going to take it
+		if (surface) free_surface(surface);
+		return 0;
+	}
+	loader->surface = surface;
+
+	SDL_Event event = {.type = loader->event_type};
+	SDL_PushEvent(&event);
+	return 0;
+}
+
+bool loader_start(struct loader *loader, char *filename, struct load_options *load, Uint32 event_type) {
+	*loader = (struct loader){.filename = filename, .load = load, .event_type = event_type};
+	loader->thread = SDL_CreateThread(loader_thread, "loader", loader);
+	if (!loader->thread) {
+		eprintf("Failed to create thread: %s\n", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+bool loader_running(struct loader *loader) {
+	return loader->thread != NULL;
+}
+
+SDL_Surface *loader_finish(struct loader *loader) {
+	// waits for the image if it isn't done yet, NULL if it failed to load
+	if (!loader->thread) return NULL;
+	SDL_WaitThread(loader->thread, NULL); // also makes the surface visible to this thread
+	loader->thread = NULL;
+	SDL_Surface *surface = loader->surface;
+	loader->surface = NULL;
+	return surface;
+}
+
+void loader_cancel(struct loader *loader) {
+	// gives up on the image without waiting for it, the decode can't be interrupted so it finishes in the background
+	if (!loader->thread) return;
+	SDL_AtomicSet(&loader->cancel, 1);
+	loader->cancelled = loader->thread;
+	loader->thread = NULL;
+}
+
+void loader_free(struct loader *loader) {
+	// waits for a cancelled decode as well, it may still be using SDL_image
+	if (loader->thread) loader_cancel(loader);
+	if (loader->cancelled) SDL_WaitThread(loader->cancelled, NULL);
+	loader->cancelled = NULL;
+	// finished just before it was cancelled
+	if (loader->surface) free_surface(loader->surface);
+	loader->surface = NULL;
+}
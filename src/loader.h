@@ -0,0 +1,23 @@
+#ifndef LOADER_H
+#define LOADER_H
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "image.h"
+
+// decodes an image on another thread, so something else can be shown in the meantime
+struct loader {
+	char *filename;
+	struct load_options *load;
+	Uint32 event_type; // pushed when the image has been decoded
+	SDL_Thread *thread;
+	SDL_Thread *cancelled; // a decode nobody waits for anymore, which frees its own image
+	SDL_atomic_t cancel;
+	SDL_Surface *surface;
+};
+
+bool loader_start(struct loader *loader, char *filename, struct load_options *load, Uint32 event_type);
+bool loader_running(struct loader *loader);
+SDL_Surface *loader_finish(struct loader *loader);
+void loader_cancel(struct loader *loader);
+void loader_free(struct loader *loader);
+#endif // LOADER_H
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <limits.h>
 #include <ncurses.h>
 #include <term.h>
 #undef buttons // conflicts with SDL
@@ -17,6 +18,14 @@
 #include "arg.h"
 #include "image.h"
 #include "term.h"
+#include "batch.h"
+#include "pool.h"
+#include "watch.h"
+#include "montage.h"
+#include "stream.h"
+#include "region.h"
+#include "loader.h"
+#include "yuv.h"
 
 // long options with getopt
 static struct option options_getopt[] = {
@@ -37,13 +46,27 @@ static struct option options_getopt[] = {
         {"unicode",    no_argument,       0, 'u'},
         {"nounicode",  no_argument,       0, 'U'},
         {"no-unicode", no_argument,       0, 'U'},
+        {"glyphs",     required_argument, 0, 'G'},
         {"4bit",       no_argument,       0, '4'},
         {"8bit",       no_argument,       0, '8'},
         {"24bit",      no_argument,       0, '6'},
+        {"palette",    required_argument, 0, 'P'},
+        {"query",      no_argument,       0, 'Q'},
+        {"max-memory", required_argument, 0, 'm'},
+        {"batch",      no_argument,       0, 'B'},
+        {"output",     required_argument, 0, 'o'},
+        {"jobs",       required_argument, 0, 'j'},
+        {"debounce",   required_argument, 0, 'd'},
+        {"grid",       no_argument,       0, 'g'},
+        {"raw",        required_argument, 0, 'R'},
+        {"fd",         required_argument, 0, 'F'},
+        {"stream",     no_argument,       0, 'l'},
+        {"crop",       required_argument, 0, 'C'},
+        {"yuv",        no_argument,       0, 'Y'},
         {0,            0,                 0, 0  }
 };
 
-bool sigusr1 = false, sigusr2 = false;
+bool sigusr1 = false, sigusr2 = false, resized = true;
 
 void sigusr1_handler() {
 	sigusr1 = true;
@@ -53,12 +76,31 @@ void sigusr2_handler() {
 	sigusr2 = true;
 }
 
+void sigwinch_handler() {
+	resized = true;
+}
+
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
-SDL_Surface *term_surface = NULL;
+SDL_Surface *term_surface = NULL; // the part of term_pool the current terminal size covers
+SDL_Surface *term_pool = NULL;    // as large as the largest terminal size seen, so shrinking or growing back is free
+struct frame_buffer frame_buffer = {0};
 SDL_Surface *surface = NULL;
 SDL_Texture *texture = NULL;
+SDL_Surface *reduced = NULL; // what the texture was made from once the pixels were released, the terminal renderer takes its textures with it when it is made again
+SDL_Point image_size;   // full resolution size, even after the pixels have been released
+SDL_Point texture_size; // size of the pixels in the texture
+enum orientation orientation = ORIENTATION_NORMAL;
 char *title_default = NULL;
+struct palette palette;
+struct watch watch = {.fd = -1, .stop_pipe = {-1, -1}};
+struct montage montage;
+bool *tile_dirty = NULL; // tiles changed since the grid was last drawn
+struct stream stream = {0};
+struct load_options load = {0};
+struct loader loader = {0};
+struct yuv_image yuv = {0}; // decoded, but not uploaded to the texture yet
+bool yuv_pending = false;
 
 bool fetch_term_size(struct position *size) {
 	struct winsize w;
@@ -78,10 +120,18 @@ bool sdl_init = false, sdl_image_init = false, term_init = false;
 // arguments
 struct {
 	char *title;
-	bool stretch, hot_reload, sigusr1, sigusr2, position_set, size_set, background_set, terminal;
+	char *palette, *output, *crop_file;
+	bool stretch, hot_reload, sigusr1, sigusr2, position_set, size_set, background_set, terminal, query, batch, grid, stream, yuv;
 	SDL_Point position, size;
 	SDL_Color background;
+	size_t max_memory;
+	unsigned int jobs, debounce;
+	bool debounce_set, raw_set, fd_set, crop_set;
+	struct raw_format raw;
+	SDL_Rect crop;
+	int fd;
 	enum bit_depth bit_depth;
+	enum glyph_mode glyphs;
 	enum toggle_mode {
 		TOGGLE_AUTO = 0,
 		TOGGLE_OFF,
@@ -89,16 +139,30 @@ struct {
 	} unicode;
 } options = {0}; // all false/NULL/0
 
+enum glyph_mode term_glyphs() {
+	// what the terminal is drawn with, once unicode support is known
+	return options.unicode == TOGGLE_ON ? options.glyphs : GLYPH_SPACE;
+}
+
 void cleanup() {
 	if (term_init) {
 		term_init = false;
 	}
+	watch_free(&watch);
+	stream_free(&stream);
+	loader_free(&loader);
+	if (tile_dirty) free(tile_dirty);
+	tile_dirty = NULL;
 	printf("\n");
 	if (texture) SDL_DestroyTexture(texture);
 	if (renderer) SDL_DestroyRenderer(renderer);
 	if (window) SDL_DestroyWindow(window);
 	if (term_surface) SDL_FreeSurface(term_surface);
-	if (surface) SDL_FreeSurface(surface);
+	if (term_pool) SDL_FreeSurface(term_pool);
+	free_frame_buffer(&frame_buffer);
+	if (surface) free_surface(surface);
+	if (reduced) SDL_FreeSurface(reduced);
+	free_yuv(&yuv);
 	if (sdl_image_init) IMG_Quit();
 	if (sdl_init) SDL_Quit();
 	if (title_default) free(title_default);
@@ -106,7 +170,9 @@ void cleanup() {
 	renderer = NULL;
 	window = NULL;
 	term_surface = NULL;
+	term_pool = NULL;
 	surface = NULL;
+	reduced = NULL;
 	sdl_image_init = false;
 	sdl_init = false;
 	title_default = NULL;
@@ -114,8 +180,51 @@ void cleanup() {
 
 bool should_reload = true;
 
+// how often the main loop wakes up to check the flags set by signal handlers, in ms
+#define IDLE_TIMEOUT (100)
+// how long the terminal size has to stay the same before a frame is rendered at it, in ms
+#define RESIZE_DEBOUNCE (40)
+
+static void update_crop() {
+	// the crop file is read again before every load, a broken file keeps the last region
+	if (options.crop_file) read_region_file(options.crop_file, &options.crop);
+}
+
+static SDL_Surface *load_image(char *filename) {
+	// from the inherited file descriptor if one was given, otherwise from the file
+	update_crop();
+	if (options.fd_set) return read_fd(options.fd, &load);
+	return load_file(filename, &load);
+}
+
+static bool load_image_yuv(char *filename) {
+	// decode straight to planes for the texture if asked to and the image allows it
+	free_yuv(&yuv);
+	yuv_pending = false;
+	if (!options.yuv || !load_yuv(filename, &yuv)) return false;
+	yuv_pending = true;
+	image_size = (SDL_Point){yuv.w, yuv.h};
+	orientation = yuv.orientation;
+	return true;
+}
+
+static void set_image_size() {
+	image_size = (SDL_Point){surface->w, surface->h};
+	orientation = surface_orientation(surface);
+}
+
 static bool should_continue() {
-	return !(sigusr1 || sigusr2 || should_reload);
+	// the signals are always caught, but their flags are only ever handled and cleared when they are enabled
+	return !((sigusr1 && options.sigusr1) || (sigusr2 && options.sigusr2) || should_reload || resized);
+}
+
+static bool update_texture(SDL_Surface *new_surface) {
+	// upload into the existing texture if it is the same size and format, which is cheaper than a new one
+	Uint32 format;
+	int w, h;
+	if (!texture || SDL_QueryTexture(texture, &format, NULL, &w, &h) != 0) return false;
+	if (format != new_surface->format->format || w != new_surface->w || h != new_surface->h) return false;
+	return SDL_UpdateTexture(texture, NULL, new_surface->pixels, new_surface->pitch) == 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -125,10 +234,13 @@ int main(int argc, char *argv[]) {
 	long nums[3];
 
 	// argument handling
-	while ((opt = getopt_long(argc, argv, ":hVt:c:p:s:b:Sr12TuU486", options_getopt, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":hVt:c:p:s:b:Sr12TuUG:486P:Qm:Bo:j:d:gR:F:lC:Y", options_getopt, NULL)) != -1) {
 		if (opt == 'h') {
 			// help text
 			printf("Usage: %s [options_getopt] file\n\
+       %s -F [fd] [options_getopt]\n\
+       %s -g [options_getopt] files...\n\
+       %s -B -s [w],[h] [options_getopt] files...\n\
 \n\
 -h --help: Shows help text\n\
 -V --version: Shows the current version\n\
@@ -138,8 +250,27 @@ int main(int argc, char *argv[]) {
 -s --size [w],[h]: Sets the window size, defaults to the size of the image\n\
 -b --background [r],[g],[b]: Sets the background colour (0-255), defaults to black or terminal background\n\
 -S --stretch: Allows the image to stretch instead of fitting to the window\n\
+-R --raw [w]x[h]:[format]: The file is uncompressed pixels instead of an image, which are shown without decoding\n\
+	[format] is one of rgb, bgr, rgba, bgra, argb, abgr (byte order),\n\
+	or rgb565, rgb888, rgba8888, argb8888, abgr8888, bgra8888 (packed, native endian)\n\
+-F --fd [fd]: Reads the image from an inherited file descriptor instead of a file\n\
+	Files and memfds are mapped into memory, so with -R the pixels are never copied\n\
+	Pipes and sockets are read once, so -m keeps their whole image\n\
+	-2 reloads from the start of the file descriptor\n\
+-l --stream: Keeps reading frames from stdin or -F and shows each one as it arrives\n\
+	Frames are PNG images, images of any format prefixed with their length (32-bit big endian),\n\
+	or with -R, raw frames one after another\n\
+	Frames that arrive faster than they can be shown are skipped\n\
+-C --crop [x],[y],[w],[h]: Only loads this part of the image, in the pixels of the file before it is rotated\n\
+	JPEG and PNG images are only decoded as far as needed, other formats are decoded whole and cut\n\
+	@[file] reads the region from the first line of [file] instead, again on every reload\n\
+-Y --yuv: Uploads 4:2:0 JPEG images as YUV planes and lets the renderer convert the colours, for window mode\n\
+	Skips a conversion pass on the CPU and uploads half the data, SDL_RENDER_DRIVER=software also works\n\
+-m --max-memory [MiB]: Images larger than this once decoded are only kept at the size they are shown at\n\
+	The image is decoded again when it needs to be shown larger, will not work with stdin or pipes\n\
 \n\
 -r --hotreload: Reloads image when it is modified, will not work with stdin\n\
+-d --debounce [ms]: Time to wait for writes to the file to finish before reloading, defaults to 50\n\
 -1 --usr1 --sigusr1: Allows the SIGUSR1 signal to resize the window to the size of the image, incompatible with -T\n\
 -2 --usr2 --sigusr2: Allows the SIGUSR2 signal to reload the image on demand\n\
 \n\
@@ -150,13 +281,27 @@ int main(int argc, char *argv[]) {
 \n\
 -u --unicode: Force enable unicode support for -T\n\
 -U --no-unicode: Disables unicode support for -T\n\
+-G --glyphs [half|quadrant|sextant]: Block characters used with unicode support, defaults to half\n\
+	quadrant shows 2x2 pixels per cell, and sextant 2x3, which needs a font with the Unicode 13 sextants\n\
 -4 --4bit: Force 4-bit colour depth (0-15)\n\
 -8 --8bit: Force 8-bit colour depth (16-255)\n\
 -6 --24bit: Force 24-bit colour depth (true color)\n\
 	Defaults to whatever the terminal supports\n\
+-P --palette [file]: Reads the 16 colours used for 4-bit colour depth from a file\n\
+	One colour per line as #rrggbb or r,g,b, lines starting with ; are ignored\n\
+-Q --query: Queries the terminal for its actual palette and background colour\n\
+\n\
+-g --grid: Shows all the files side by side in a grid, will not work with stdin\n\
+	-s sets the size of the whole grid, which defaults to 1280x720 or the terminal size\n\
+	With -r, only the files that changed are loaded again\n\
+-B --batch: Renders every file as it would be shown with -T, without needing a terminal\n\
+	-s is required and sets the size in cells, -p is ignored\n\
+	Output goes to stdout in the order of the files, unless -o is set\n\
+-o --output [dir]: Writes each file to [dir]/[name].ans instead, for -B, the names have to differ\n\
+-j --jobs [n]: Number of threads to load images with, for -g and -B, defaults to the number of CPUs\n\
 \n\
 ",
-			       PROJECT_NAME);
+			       PROJECT_NAME, PROJECT_NAME, PROJECT_NAME, PROJECT_NAME);
 
 			return 0;
 		} else if (opt == 'V') {
@@ -224,6 +369,11 @@ int main(int argc, char *argv[]) {
 					if (options.unicode != TOGGLE_AUTO) invalid = true;
 					options.unicode = opt == 'u' ? TOGGLE_ON : TOGGLE_OFF;
 					break;
+				case 'G':
+					if (options.glyphs) invalid = true;
+					if (parse_glyph_mode(optarg, &options.glyphs) && options.glyphs != GLYPH_SPACE) break;
+					invalid = true;
+					break;
 				case '4':
 				case '8':
 				case '6':
@@ -231,6 +381,91 @@ int main(int argc, char *argv[]) {
 					options.bit_depth = opt == '4' ? BIT_4 : opt == '8' ? BIT_8
 					                                                    : BIT_24;
 					break;
+				case 'P':
+					if (options.palette) invalid = true;
+					options.palette = optarg;
+					break;
+				case 'Q':
+					if (options.query) invalid = true;
+					options.query = true;
+					break;
+				case 'B':
+					if (options.batch) invalid = true;
+					options.batch = true;
+					break;
+				case 'g':
+					if (options.grid) invalid = true;
+					options.grid = true;
+					break;
+				case 'R':
+					if (options.raw_set) invalid = true;
+					if (parse_raw_format(optarg, &options.raw)) {
+						options.raw_set = true;
+						break;
+					}
+					invalid = true;
+					break;
+				case 'F':
+					if (options.fd_set) invalid = true;
+					if (parse_num_array(optarg, nums, 1) && nums[0] >= 0 && nums[0] <= INT_MAX) {
+						options.fd = (int) nums[0];
+						options.fd_set = true;
+						break;
+					}
+					invalid = true;
+					break;
+				case 'C':
+					if (options.crop_set) invalid = true;
+					if (optarg[0] == '@') {
+						// read once now, so a missing or broken file is an error straight away
+						options.crop_file = optarg + 1;
+						if (read_region_file(options.crop_file, &options.crop)) {
+							options.crop_set = true;
+							break;
+						}
+					} else if (parse_region(optarg, &options.crop)) {
+						options.crop_set = true;
+						break;
+					}
+					invalid = true;
+					break;
+				case 'Y':
+					if (options.yuv) invalid = true;
+					options.yuv = true;
+					break;
+				case 'l':
+					if (options.stream) invalid = true;
+					options.stream = true;
+					break;
+				case 'o':
+					if (options.output) invalid = true;
+					options.output = optarg;
+					break;
+				case 'j':
+					if (options.jobs) invalid = true;
+					if (parse_num_array(optarg, nums, 1) && nums[0] > 0 && nums[0] <= 1024) {
+						options.jobs = (unsigned int) nums[0];
+						break;
+					}
+					invalid = true;
+					break;
+				case 'd':
+					if (options.debounce_set) invalid = true;
+					if (parse_num_array(optarg, nums, 1) && nums[0] >= 0 && nums[0] <= INT_MAX) {
+						options.debounce = (unsigned int) nums[0];
+						options.debounce_set = true;
+						break;
+					}
+					invalid = true;
+					break;
+				case 'm':
+					if (options.max_memory) invalid = true;
+					if (parse_num_array(optarg, nums, 1) && nums[0] > 0 && (unsigned long) nums[0] <= SIZE_MAX >> 20) {
+						options.max_memory = (size_t) nums[0] << 20;
+						break;
+					}
+					invalid = true;
+					break;
 				default:
 					invalid = true;
 					break;
@@ -238,11 +473,63 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if (optind != argc - 1 || invalid || !argv[optind][0]) {
+	if (options.fd_set) {
+		// the file descriptor replaces the file argument
+		if (optind != argc || options.batch || options.grid) invalid = true;
+	} else if (optind >= argc || (optind != argc - 1 && !options.batch && !options.grid) || !argv[optind][0] || (options.batch && options.grid)) {
+		invalid = true;
+	}
+
+	if (invalid) {
 		eprintf("Invalid usage, try --help\n");
 		return 1;
 	}
 
+	if (options.stream) {
+		// frames only come from stdin or the file descriptor
+		if (options.batch || options.grid || (!options.fd_set && strcmp(argv[optind], "-") != 0)) {
+			eprintf("Stream mode can only read from stdin or a file descriptor\n");
+			return 1;
+		}
+		if (options.hot_reload || options.sigusr2 || options.max_memory) {
+			eprintf("Cannot use -r, -2 or -m in stream mode, ignoring...\n");
+			options.hot_reload = options.sigusr2 = false;
+			options.max_memory = 0;
+		}
+	}
+
+	if (options.fd_set && options.hot_reload) {
+		eprintf("Cannot hot-reload with a file descriptor, ignoring...\n");
+		options.hot_reload = false;
+	}
+
+	if (options.batch) {
+		if (!options.size_set) {
+			eprintf("Batch mode requires the size to be set\n");
+			return 1;
+		}
+		if (options.hot_reload || options.sigusr1 || options.sigusr2 || options.query || options.max_memory) {
+			eprintf("Cannot use -r, -1, -2, -Q or -m in batch mode, ignoring...\n");
+			options.hot_reload = options.sigusr1 = options.sigusr2 = options.query = false;
+			options.max_memory = 0;
+		}
+		options.terminal = true; // renders the same way
+	} else if (options.output) {
+		eprintf("Cannot specify output without batch mode, ignoring...\n");
+		options.output = NULL;
+	}
+
+	if (options.grid && options.max_memory) {
+		// every tile is decoded again whenever its file changes, and the sheet they are drawn on is kept
+		eprintf("Cannot use -m in grid mode, ignoring...\n");
+		options.max_memory = 0;
+	}
+
+	if (options.jobs && !options.batch && !options.grid) {
+		eprintf("Cannot specify jobs without batch or grid mode, ignoring...\n");
+		options.jobs = 0;
+	}
+
 	if (options.terminal) {
 		if (options.sigusr1) {
 			eprintf("Cannot use SIGUSR1 in terminal mode, ignoring...\n");
@@ -252,15 +539,67 @@ int main(int argc, char *argv[]) {
 			eprintf("Cannot set position without size being set in terminal mode, ignoring...\n");
 			options.position_set = options.size_set = false;
 		}
-	} else if (options.unicode != TOGGLE_AUTO) {
+		if (options.glyphs && options.unicode == TOGGLE_OFF) {
+			eprintf("Cannot specify glyphs without unicode support, ignoring...\n");
+			options.glyphs = GLYPH_SPACE;
+		} else if (options.glyphs) {
+			options.unicode = TOGGLE_ON; // asking for them means the terminal has them
+		}
+		if (!options.glyphs) options.glyphs = GLYPH_HALF;
+	} else if (options.unicode != TOGGLE_AUTO || options.glyphs) {
 		eprintf("Cannot specify unicode support without terminal mode, ignoring...\n");
 		options.unicode = TOGGLE_AUTO;
+		options.glyphs = GLYPH_SPACE;
 	} else if (options.bit_depth != BIT_AUTO) {
 		eprintf("Cannot specify bit depth without terminal mode, ignoring...\n");
 		options.bit_depth = BIT_AUTO;
+	} else if (options.palette || options.query) {
+		eprintf("Cannot specify palette without terminal mode, ignoring...\n");
+		options.palette = NULL;
+		options.query = false;
 	}
 
-	char *filename = argv[optind];
+	load = (struct load_options){
+	        .raw = options.raw_set ? &options.raw : NULL,
+	        .crop = options.crop_set ? &options.crop : NULL,
+	        .threads = options.batch || options.grid ? 1 : 0, // those already load an image per core
+	};
+
+	if (options.yuv && (options.terminal || options.grid || options.stream || options.fd_set || options.raw_set || options.crop_set)) {
+		eprintf("Can only use -Y for a single image file in window mode, ignoring...\n");
+		options.yuv = false;
+	}
+
+	default_palette(&palette);
+	if (options.palette && !read_palette_file(options.palette, &palette)) return 1;
+
+	if (options.batch) {
+		// no tty, so there is nothing to detect, use the best output unless told otherwise
+		build_palette_index(&palette);
+		struct batch_options batch = {
+		        .render = {
+		                .size = options.size,
+		                .background = options.background,
+		                .glyphs = options.unicode != TOGGLE_OFF ? options.glyphs : GLYPH_SPACE,
+		                .stretch = options.stretch,
+		                .bit_depth = options.bit_depth == BIT_AUTO ? BIT_24 : options.bit_depth,
+		                .palette = &palette,
+		        },
+		        .load = &load,
+		        .output_dir = options.output,
+		        .threads = options.jobs ? options.jobs : pool_default_threads(),
+		};
+
+		if (!(IMG_Init(-1))) {
+			eprintf("Failed to initialize SDL image: %s\n", IMG_GetError());
+			return 1;
+		}
+		bool ok = run_batch(argv + optind, (size_t) (argc - optind), &batch);
+		IMG_Quit();
+		return ok ? 0 : 1;
+	}
+
+	char *filename = options.fd_set ? NULL : argv[optind];
 
 	atexit(cleanup);
 
@@ -280,19 +619,96 @@ int main(int argc, char *argv[]) {
 
 	sdl_image_init = true;
 
-	FILE *fp = open_file(filename);
-	if (!fp) return 1;
+	FILE *fp = NULL;
+	bool can_release = false;
+	Uint32 frame_event = (Uint32) -1, loaded_event = (Uint32) -1;
+	bool new_frame = false, image_loaded = false;
+	SDL_Point full_size;
+
+	if (options.grid) {
+		size_t count = (size_t) (argc - optind);
+		for (size_t i = 0; i < count; ++i) {
+			if (strcmp(argv[optind + i], "-") == 0) {
+				eprintf("Cannot use stdin in grid mode\n");
+				return 1;
+			}
+		}
 
-	if (fp == stdin && options.hot_reload) {
-		eprintf("Cannot hot-reload with stdin, ignoring...\n");
-		options.hot_reload = false;
-	}
+		tile_dirty = calloc(count, sizeof(bool));
+		if (!tile_dirty) err(1, "calloc");
+
+		// the tiles are scaled to the size of the sheet, so pick one that fits the output
+		SDL_Point sheet_size = {MONTAGE_DEFAULT_W, MONTAGE_DEFAULT_H};
+		if (options.terminal) {
+			struct position cells;
+			if (options.size_set) cells = (struct position){options.size.x, options.size.y};
+			else if (!fetch_term_size(&cells)) {
+				eprintf("Failed to get terminal size\n");
+				return 1;
+			}
+			// as many pixels as the glyphs show, in the shape of the terminal, whose cells are twice as tall as wide
+			SDL_Point cell = glyph_cell_size(options.glyphs);
+			sheet_size = (SDL_Point){(int) cells.x * cell.x, (int) cells.y * cell.x * 2};
+		} else if (options.size_set) {
+			sheet_size = options.size;
+		}
+
+		montage_layout(&montage, argv + optind, count, &load, options.jobs ? options.jobs : pool_default_threads());
+		surface = montage_create(&montage, sheet_size);
+	} else if (options.stream) {
+		frame_event = SDL_RegisterEvents(1);
+		if (frame_event == (Uint32) -1) {
+			eprintf("Failed to register event: %s\n", SDL_GetError());
+			return 1;
+		}
+		if (!stream_start(&stream, options.fd_set ? options.fd : STDIN_FILENO, &load, frame_event)) return 1;
+
+		// the first frame decides the size of the window, any that fail to decode before it are skipped like later ones
+		while (!(surface = stream_take(&stream, true)) && !stream_ended(&stream));
+		if (!surface) eprintf("Stream ended without a frame that could be decoded\n");
+	} else if (options.fd_set) {
+		// only regular files can be mapped again later, whatever came through a pipe or socket is gone once read
+		struct stat st;
+		can_release = options.max_memory && fstat(options.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+		surface = load_image(filename);
+	} else {
+		fp = open_file(filename);
+		if (!fp) return 1;
+
+		if (fp == stdin && options.hot_reload) {
+			eprintf("Cannot hot-reload with stdin, ignoring...\n");
+			options.hot_reload = false;
+		}
 
-	surface = read_file(fp);
-	close_file(fp);
-	if (!surface) return 1;
+		// the pixels can only be released if the file can be decoded again later
+		can_release = fp != stdin && options.max_memory;
 
-	if (!options.title && !options.terminal) {
+		if (fp != stdin && load_image_yuv(filename)) {
+			close_file(fp);
+		} else if (fp != stdin && !load.raw && !load.crop && (surface = load_thumbnail(filename, &full_size))) {
+			// show the thumbnail embedded in large photos straight away, and decode the full image in the background
+			close_file(fp);
+			loaded_event = SDL_RegisterEvents(1);
+			if (loaded_event == (Uint32) -1) {
+				eprintf("Failed to register event: %s\n", SDL_GetError());
+				return 1;
+			}
+			if (!loader_start(&loader, filename, &load, loaded_event)) return 1;
+		} else {
+			surface = read_file(fp, &load);
+			close_file(fp);
+		}
+	}
+	if (!yuv_pending) {
+		if (!surface) return 1;
+		set_image_size();
+	}
+	// laid out at the size of the full image, so nothing moves when it replaces the thumbnail
+	if (loader_running(&loader)) image_size = full_size;
+
+	if (!options.title && !options.terminal && (options.grid || options.fd_set)) {
+		options.title = PROJECT_NAME;
+	} else if (!options.title && !options.terminal) {
 		// if title isn't set, set it to the last component of filename, except in terminal mode
 		options.title = strrchr(filename, '/');
 		if (!options.title) options.title = filename;
@@ -312,8 +728,8 @@ int main(int argc, char *argv[]) {
 		        options.title,
 		        options.position_set ? options.position.x : (int) SDL_WINDOWPOS_UNDEFINED,
 		        options.position_set ? options.position.y : (int) SDL_WINDOWPOS_UNDEFINED,
-		        options.size_set ? options.size.x : surface->w,
-		        options.size_set ? options.size.y : surface->h,
+		        options.size_set ? options.size.x : oriented_size(image_size, orientation).x,
+		        options.size_set ? options.size.y : oriented_size(image_size, orientation).y,
 		        SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 
 		if (options.position_set) {
@@ -343,15 +759,37 @@ int main(int argc, char *argv[]) {
 	if (sigaction(SIGUSR1, &sa, NULL) == -1) err(1, "sigaction");
 	sa.sa_handler = sigusr2_handler;
 	if (sigaction(SIGUSR2, &sa, NULL) == -1) err(1, "sigaction");
+	if (options.terminal) {
+		sa.sa_handler = sigwinch_handler;
+		if (sigaction(SIGWINCH, &sa, NULL) == -1) err(1, "sigaction");
+	}
 
-	// variables for hot-reload
-	struct stat st;                      // stat
-	time_t prev_mtime = 0;               // previous modification date
-	unsigned long long last_checked = 0; // the time at when we have last checked
+	// hot-reload is driven by events from the watch thread
+	Uint32 reload_event = (Uint32) -1;
+	bool file_changed = false;
+	if (options.hot_reload) {
+		reload_event = SDL_RegisterEvents(1);
+		if (reload_event == (Uint32) -1) {
+			eprintf("Failed to register event: %s\n", SDL_GetError());
+			return 1;
+		}
+		if (!watch_init(&watch, options.debounce_set ? options.debounce : DEBOUNCE_DEFAULT)) return 1;
+		if (options.grid) {
+			for (size_t i = 0; i < montage.count; ++i)
+				if (!watch_add(&watch, montage.files[i])) return 1;
+		} else if (!watch_add(&watch, filename)) {
+			return 1;
+		}
+		// changing the region reloads the image too
+		if (options.crop_file && !watch_add(&watch, options.crop_file)) return 1;
+		if (!watch_start(&watch, reload_event)) return 1;
+	}
 
 	// terminal mode
 	struct position term_size;
-	bool term_should_render = true;
+	bool term_should_render = true, resize_pending = false;
+	bool needs_redraw = true; // nothing is drawn while the image and the window stay the same
+	unsigned long long resize_time = 0;
 
 	// main loop
 	bool running = true;
@@ -360,55 +798,105 @@ int main(int argc, char *argv[]) {
 		if (window && sigusr1 && options.sigusr1) {
 			// resize the window to the size of the image
 			sigusr1 = false;
-			SDL_SetWindowSize(window, surface->w, surface->h);
+			SDL_Point size = oriented_size(image_size, orientation);
+			SDL_SetWindowSize(window, size.x, size.y);
+			needs_redraw = true;
 		}
 
-		// from signal handler
-		should_reload = sigusr2 && options.sigusr2;
-
-		if (!should_reload && options.hot_reload) {
-			// get current time
-			unsigned long long current_time = get_time();
-
-			// if a second has passed since we last checked this
-			if (current_time > last_checked + 1000) {
-				// set time last checked
-				last_checked = current_time;
+		// from signal handler or the watch thread
+		bool reload_all = sigusr2 && options.sigusr2;
+		should_reload = reload_all || file_changed;
+		file_changed = false;
 
-				// stat the file
-				if (stat(filename, &st) != 0) err(1, "hot-reload: %s", filename);
+		if (should_reload && options.grid) {
+			term_should_render = needs_redraw = true;
+			sigusr2 = false;
 
-				// reload if modification date has changed
-				if (st.st_mtime != prev_mtime) {
-					prev_mtime = st.st_mtime;
-					should_reload = true;
+			// only decode the tiles that changed
+			update_crop();
+			if (reload_all)
+				for (size_t i = 0; i < montage.count; ++i) tile_dirty[i] = true;
+			if (!montage_update(&montage, surface, tile_dirty)) return 1;
+
+			// and only upload those parts of the sheet
+			Uint32 format;
+			if (texture && SDL_QueryTexture(texture, &format, NULL, NULL, NULL) == 0 && format == surface->format->format) {
+				for (size_t i = 0; i < montage.count; ++i) {
+					if (!tile_dirty[i]) continue;
+					SDL_Rect cell = montage_cell(&montage, surface, i);
+					Uint8 *pixels = (Uint8 *) surface->pixels + cell.y * surface->pitch + cell.x * surface->format->BytesPerPixel;
+					SDL_UpdateTexture(texture, &cell, pixels, surface->pitch);
 				}
+			} else if (texture) {
+				SDL_DestroyTexture(texture);
+				texture = NULL;
 			}
-		}
 
-		if (should_reload) {
-			term_should_render = true;
+			for (size_t i = 0; i < montage.count; ++i) tile_dirty[i] = false;
+		} else if (should_reload) {
+			term_should_render = needs_redraw = true;
 			sigusr2 = false;
 
-			// reload the image
-			fp = open_file(filename);
-			if (!fp) return 1;
-			SDL_Surface *new_surface = read_file(fp);
-			close_file(fp);
+			// the image being decoded in the background is already out of date, so don't wait for it
+			loader_cancel(&loader);
+			image_loaded = false;
 
-			// TODO: load new image in a separate thread and switch to it when done
-			if (new_surface) {
+			// reload the image
+			SDL_Surface *new_surface;
+			if (load_image_yuv(filename)) {
+				if (texture) SDL_DestroyTexture(texture);
+				texture = NULL;
+				if (surface) free_surface(surface);
+				surface = NULL;
+			} else if ((new_surface = load_image(filename))) {
+				// TODO: load new image in a separate thread and switch to it when done
 				// destroy the old texture and surface
 				if (texture) SDL_DestroyTexture(texture);
 				texture = NULL;
 
-				if (surface) SDL_FreeSurface(surface);
+				if (surface) free_surface(surface);
 				surface = new_surface;
+				set_image_size();
 			} else {
 				eprintf("Failed to load updated image\n");
 			}
 		}
 
+		// unless a reload already replaced the thumbnail
+		if (image_loaded && loader_running(&loader)) {
+			// replace the thumbnail with the full image
+			SDL_Surface *loaded = loader_finish(&loader);
+			if (loaded) {
+				term_should_render = needs_redraw = true;
+				if (texture) SDL_DestroyTexture(texture);
+				texture = NULL;
+				free_surface(surface);
+				surface = loaded;
+				set_image_size();
+			} else {
+				eprintf("Failed to load the full image, showing its thumbnail\n");
+			}
+		}
+		image_loaded = false;
+
+		if (new_frame) {
+			new_frame = false;
+
+			// only the newest frame is decoded, any before it were dropped
+			SDL_Surface *frame = stream_take(&stream, false);
+			if (frame) {
+				term_should_render = needs_redraw = true;
+				if (!update_texture(frame)) {
+					if (texture) SDL_DestroyTexture(texture);
+					texture = NULL;
+				}
+				if (surface) free_surface(surface);
+				surface = frame;
+				set_image_size();
+				texture_size = image_size;
+			}
+		}
+
 		if (options.terminal) {
 			if (!term_init) {
 				if (setupterm(NULL, STDOUT_FILENO, NULL) != OK) {
@@ -416,6 +904,17 @@ int main(int argc, char *argv[]) {
 					return 1;
 				}
 
+				if (options.query) {
+					// use the terminal's own colors, and its background unless one was specified
+					struct color background;
+					bool background_set = false;
+					if (!query_term_palette(&palette, &background, &background_set))
+						eprintf("Terminal did not report its palette, using defaults\n");
+					if (background_set && !options.background_set)
+						options.background = (SDL_Color){.r = background.r, .g = background.g, .b = background.b, .a = 255};
+				}
+				build_palette_index(&palette);
+
 				if (options.title) printf("\x1b]0;%s\007", options.title); // print title
 
 				int colors = tigetnum("colors");
@@ -435,104 +934,222 @@ int main(int argc, char *argv[]) {
 				term_init = true;
 			}
 
-			struct position old_size = term_size;
-			if (!fetch_term_size(&term_size)) {
-				eprintf("Failed to get terminal size\n");
-				return 1;
+			if (resized) {
+				// dragging the edge of the terminal sends a storm of these, so wait for the size to settle
+				resized = false;
+				resize_pending = true;
+				resize_time = get_time();
 			}
 
-			// if size has changed
-			if (!renderer || old_size.x != term_size.x || old_size.y != term_size.y) {
-				term_should_render = true;
-
-				// dsetroy the texture, renderer and surface
-				if (texture) SDL_DestroyTexture(texture);
-				texture = NULL;
-				if (renderer) SDL_DestroyRenderer(renderer);
-				renderer = NULL;
-				if (term_surface) SDL_FreeSurface(term_surface);
-
-				term_surface = SDL_CreateRGBSurface(0, term_size.x, term_size.y * (options.unicode == TOGGLE_ON ? 2 : 1), TERM_DEPTH, TERM_R_MASK, TERM_G_MASK, TERM_B_MASK, TERM_A_MASK);
-				if (!term_surface) {
-					eprintf("Failed to create terminal surface: %s\n", SDL_GetError());
+			if (resize_pending && (!renderer || get_time() - resize_time >= RESIZE_DEBOUNCE)) {
+				resize_pending = false;
+				struct position old_size = term_size;
+				if (!fetch_term_size(&term_size)) {
+					eprintf("Failed to get terminal size\n");
 					return 1;
 				}
 
-				renderer = SDL_CreateSoftwareRenderer(term_surface);
-				if (!renderer) {
-					eprintf("Failed to create software renderer: %s\n", SDL_GetError());
-					return 1;
+				// if size has changed
+				if (!renderer || old_size.x != term_size.x || old_size.y != term_size.y) {
+					term_should_render = needs_redraw = true;
+					SDL_Point cell = glyph_cell_size(term_glyphs());
+					int w = (int) term_size.x * cell.x, h = (int) term_size.y * cell.y;
+
+					if (!term_pool || w > term_pool->w || h > term_pool->h) {
+						// the renderer draws into the pool, so it and the texture have to be created again
+						int pool_w = term_pool && term_pool->w > w ? term_pool->w : w;
+						int pool_h = term_pool && term_pool->h > h ? term_pool->h : h;
+						if (texture) SDL_DestroyTexture(texture);
+						texture = NULL;
+						if (renderer) SDL_DestroyRenderer(renderer);
+						renderer = NULL;
+						if (term_surface) SDL_FreeSurface(term_surface);
+						term_surface = NULL;
+						if (term_pool) SDL_FreeSurface(term_pool);
+
+						term_pool = SDL_CreateRGBSurface(0, pool_w, pool_h, TERM_DEPTH, TERM_R_MASK, TERM_G_MASK, TERM_B_MASK, TERM_A_MASK);
+						if (!term_pool) {
+							eprintf("Failed to create terminal surface: %s\n", SDL_GetError());
+							return 1;
+						}
+
+						renderer = SDL_CreateSoftwareRenderer(term_pool);
+						if (!renderer) {
+							eprintf("Failed to create software renderer: %s\n", SDL_GetError());
+							return 1;
+						}
+					}
+
+					// the frame is the top left of the pool, sharing its pixels
+					if (term_surface) SDL_FreeSurface(term_surface);
+					term_surface = SDL_CreateRGBSurfaceFrom(term_pool->pixels, w, h, TERM_DEPTH, term_pool->pitch, TERM_R_MASK, TERM_G_MASK, TERM_B_MASK, TERM_A_MASK);
+					if (!term_surface) {
+						eprintf("Failed to create terminal surface: %s\n", SDL_GetError());
+						return 1;
+					}
+					SDL_RenderSetViewport(renderer, &(SDL_Rect){0, 0, w, h});
 				}
 			}
 		}
 
-		// set background color
-		SDL_SetRenderDrawColor(renderer, options.background.r, options.background.g, options.background.b, 255);
-		SDL_RenderClear(renderer);
-
-		// get the size of the window
-		SDL_Point window_size;
-		if (window) {
-			SDL_GetWindowSize(window, &window_size.x, &window_size.y);
-		} else if (options.terminal) {
-			if (options.size_set)
-				window_size = (SDL_Point){options.size.x, options.size.y}; // specified size
-			else
-				window_size = (SDL_Point){term_surface->w, term_surface->h}; // whole terminal size
-		} else {
-			eprintf("Window is NULL\n");
-			return 1;
-		}
+		if (needs_redraw) {
+			needs_redraw = false;
+
+			// set background color
+			SDL_SetRenderDrawColor(renderer, options.background.r, options.background.g, options.background.b, 255);
+			SDL_RenderClear(renderer);
+
+			// get the size of the window
+			SDL_Point window_size, cell = glyph_cell_size(term_glyphs()); // -s and -p are in cells in terminal mode
+			if (window) {
+				SDL_GetWindowSize(window, &window_size.x, &window_size.y);
+			} else if (options.terminal) {
+				if (options.size_set)
+					window_size = (SDL_Point){options.size.x * cell.x, options.size.y * cell.y}; // specified size
+				else
+					window_size = (SDL_Point){term_surface->w, term_surface->h}; // whole terminal size
+			} else {
+				eprintf("Window is NULL\n");
+				return 1;
+			}
 
-		// find the right scaling mode to fit the image in the window
-		SDL_Rect rect;
-		if (options.stretch) {
-			// stretch image to window/terminal size
-			rect = (SDL_Rect){.x = 0, .y = 0, .w = window_size.x, .h = window_size.y};
-		} else {
-			// fit image to window/terminal size
-			unsigned int x_mul = options.terminal && options.unicode != TOGGLE_ON ? 2u : 1u;
-			rect = get_fit_mode((SDL_Point){surface->w * (x_mul), surface->h}, window_size);
-		}
+			// find the right scaling mode to fit the image in the window
+			SDL_Rect rect;
+			if (options.stretch) {
+				// stretch image to window/terminal size
+				rect = (SDL_Rect){.x = 0, .y = 0, .w = window_size.x, .h = window_size.y};
+			} else {
+				// fit image to window/terminal size
+				SDL_Point size = oriented_size(image_size, orientation);
+				rect = get_fit_mode(options.terminal ? glyph_fit_size(size, term_glyphs()) : size, window_size);
+			}
 
-		if (options.terminal) {
-			if (options.position_set) {
-				// offset by the correct position
-				rect.x += options.position.x;
-				rect.y += options.position.y;
-			} else if (options.size_set) {
-				// center the image in the terminal
-				rect.x = ((int) term_size.x - rect.w) / 2;
-				rect.y = ((int) term_size.y - rect.h) / 2;
+			if (options.terminal) {
+				if (options.position_set) {
+					// offset by the correct position
+					rect.x += options.position.x * cell.x;
+					rect.y += options.position.y * cell.y;
+				} else if (options.size_set) {
+					// center the image in the terminal
+					rect.x = ((int) term_size.x * cell.x - rect.w) / 2;
+					rect.y = ((int) term_size.y * cell.y - rect.h) / 2;
+				}
+			}
+
+			// size of the texture when drawn, before it is made upright
+			SDL_Rect draw_rect = texture_rect(rect, orientation);
+
+			if (texture && !surface && (draw_rect.w > texture_size.x || draw_rect.h > texture_size.y) &&
+			    (texture_size.x < image_size.x || texture_size.y < image_size.y)) {
+				// the reduced copy is now too small to be shown, so decode the image again, and keep showing it if that fails
+				surface = load_image(filename);
+				if (surface) {
+					SDL_DestroyTexture(texture);
+					texture = NULL;
+					set_image_size();
+				} else {
+					eprintf("Failed to load the image again, showing it at a lower resolution\n");
+				}
+			}
+
+			if (!texture && yuv_pending) {
+				// uploaded the way it came out of the decoder, the renderer converts it to rgb
+				texture = yuv_texture(renderer, &yuv);
+				if (texture) {
+					texture_size = image_size;
+					if (reduced) SDL_FreeSurface(reduced);
+					reduced = NULL;
+				} else {
+					eprintf("Failed to create YUV texture, using RGB: %s\n", SDL_GetError());
+				}
+				free_yuv(&yuv);
+				yuv_pending = false;
 			}
-		}
 
-		if (!texture) {
-			texture = SDL_CreateTextureFromSurface(renderer, surface);
 			if (!texture) {
-				eprintf("Failed to create texture: %s\n", SDL_GetError());
-				return 1;
+				if (!surface) {
+					// the pixels were released, and the texture made from them is gone
+					surface = load_image(filename);
+					if (surface) set_image_size();
+					else if (reduced) eprintf("Failed to load the image again, showing it at a lower resolution\n");
+					else
+						return 1;
+				}
+
+				SDL_Surface *upload = surface ? surface : reduced;
+				bool over_budget = surface && can_release && !loader_running(&loader) && surface_size(surface) > options.max_memory;
+				if (over_budget && draw_rect.w > 0 && draw_rect.h > 0 && draw_rect.w < surface->w && draw_rect.h < surface->h) {
+					// only upload as many pixels as are being shown
+					upload = scale_surface(surface, draw_rect.w, draw_rect.h);
+					if (!upload) upload = surface;
+				}
+
+				texture = SDL_CreateTextureFromSurface(renderer, upload);
+				if (!texture) {
+					eprintf("Failed to create texture: %s\n", SDL_GetError());
+					return 1;
+				}
+				texture_size = (SDL_Point){upload->w, upload->h};
+
+				if (reduced && upload != reduced) {
+					// made from the image again
+					SDL_FreeSurface(reduced);
+					reduced = NULL;
+				}
+				if (over_budget && upload != surface && options.terminal) {
+					// kept so the texture can be made again for a larger terminal even if the file is gone by then
+					reduced = upload;
+				} else if (upload != surface && upload != reduced) {
+					SDL_FreeSurface(upload);
+				}
+				if (over_budget && (upload != surface || !options.terminal)) {
+					// the texture has its own copy now
+					free_surface(surface);
+					surface = NULL;
+				}
 			}
-		}
 
-		// draw the image with the rectangle
-		SDL_RenderCopy(renderer, texture, NULL, &rect);
+			// draw the image with the rectangle
+			draw_oriented(renderer, texture, rect, orientation);
 
-		SDL_RenderPresent(renderer);
+			SDL_RenderPresent(renderer);
+		}
 
-		if (term_should_render && options.terminal) {
+		if (term_should_render && options.terminal && !resize_pending) {
 			term_should_render = false;
-			if (render_image_to_terminal(term_surface, options.unicode == TOGGLE_ON, options.bit_depth, stdout, should_continue) == FAIL) {
+			enum render_callback rendered = render_frame(&frame_buffer, term_surface, term_glyphs(), options.bit_depth, &palette, stdout, should_continue);
+			if (rendered == FAIL) {
 				eprintf("Failed to render image to terminal\n");
 				return 1;
 			}
+			// cancelled before anything was written, so draw it again once whatever stopped it is handled
+			if (rendered == ABORT) term_should_render = true;
 		}
 
+		// sleep until something happens, the other threads push events, only signals need a regular wake up
+		int timeout = options.sigusr1 || options.sigusr2 || options.terminal ? IDLE_TIMEOUT : -1; // -1 waits for ever
+		if (resize_pending) {
+			unsigned long long waited = get_time() - resize_time;
+			timeout = waited >= RESIZE_DEBOUNCE ? 0 : (int) (RESIZE_DEBOUNCE - waited);
+		}
 		SDL_Event event;
-		while (SDL_PollEvent(&event) != 0) {
-			if (event.type == SDL_QUIT) {
-				running = false;
-			}
+		if (SDL_WaitEventTimeout(&event, timeout)) {
+			do {
+				if (event.type == SDL_QUIT) {
+					running = false;
+				} else if (event.type == SDL_WINDOWEVENT) {
+					needs_redraw = true; // exposed, resized and the like
+				} else if (event.type == frame_event) {
+					new_frame = true;
+				} else if (event.type == loaded_event) {
+					image_loaded = true;
+				} else if (event.type == reload_event) {
+					file_changed = true;
+					if (tile_dirty && (size_t) event.user.code < montage.count) tile_dirty[event.user.code] = true;
+					else if (tile_dirty) // the crop file, which applies to every tile
+						for (size_t i = 0; i < montage.count; ++i) tile_dirty[i] = true;
+				}
+			} while (SDL_PollEvent(&event) != 0);
 		}
 	}
 
@@ -0,0 +1,115 @@
+#include <err.h>
+#include <stdlib.h>
+
+#include <SDL2/SDL.h>
+
+#include "montage.h"
+#include "image.h"
+#include "pool.h"
+#include "util.h"
+
+struct montage_job {
+	struct montage *montage;
+	SDL_Surface *sheet;
+	bool *dirty;
+	SDL_Surface **thumbnails;
+};
+
+void montage_layout(struct montage *montage, char **files, size_t count, struct load_options *load, unsigned int threads) {
+	// as close to a square grid as possible
+	int cols = 1;
+	while ((size_t) cols * cols < count) ++cols;
+	*montage = (struct montage){
+	        .files = files,
+	        .count = count,
+	        .cols = cols,
+	        .rows = (int) ((count + cols - 1) / cols),
+	        .threads = threads,
+	        .load = load,
+	};
+}
+
+SDL_Rect montage_cell(struct montage *montage, SDL_Surface *sheet, size_t index) {
+	// cells are spread over the whole sheet, so rounding never leaves a gap at the edge
+	int col = (int) (index % montage->cols), row = (int) (index / montage->cols);
+	int x1 = sheet->w * col / montage->cols, x2 = sheet->w * (col + 1) / montage->cols;
+	int y1 = sheet->h * row / montage->rows, y2 = sheet->h * (row + 1) / montage->rows;
+	return (SDL_Rect){.x = x1, .y = y1, .w = x2 - x1, .h = y2 - y1};
+}
+
+static void thumbnail_job(size_t index, void *data) {
+	// decode a file and scale it down to its cell straight away, so the full image is only held briefly
+	struct montage_job *job = data;
+	if (!job->dirty[index]) return;
+
+	SDL_Surface *surface = load_file(job->montage->files[index], job->montage->load);
+	if (!surface) return;
+
+	SDL_Rect cell = montage_cell(job->montage, job->sheet, index);
+	SDL_Point size = oriented_size((SDL_Point){surface->w, surface->h}, surface_orientation(surface));
+	SDL_Rect fit = get_fit_mode(size, (SDL_Point){cell.w, cell.h});
+	if (fit.w > 0 && fit.h > 0) job->thumbnails[index] = scale_upright(surface, fit.w, fit.h);
+	free_surface(surface);
+}
+
+bool montage_update(struct montage *montage, SDL_Surface *sheet, bool *dirty) {
+	// decode the tiles marked as dirty in parallel and draw them onto the sheet
+	struct montage_job job = {.montage = montage, .sheet = sheet, .dirty = dirty};
+	job.thumbnails = calloc(montage->count, sizeof(SDL_Surface *));
+	if (!job.thumbnails) {
+		warn("calloc");
+		return false;
+	}
+
+	if (!pool_run(montage->count, montage->threads, thumbnail_job, &job)) {
+		free(job.thumbnails);
+		return false;
+	}
+
+	// drawing happens here rather than in the threads, as blitting onto the same surface isn't thread safe
+	for (size_t i = 0; i < montage->count; ++i) {
+		if (!dirty[i]) continue;
+		SDL_Rect cell = montage_cell(montage, sheet, i);
+		SDL_FillRect(sheet, &cell, SDL_MapRGBA(sheet->format, 0, 0, 0, 0)); // clear to transparent
+
+		SDL_Surface *thumbnail = job.thumbnails[i];
+		if (!thumbnail) {
+			eprintf("%s: Failed to load tile\n", montage->files[i]);
+			continue;
+		}
+
+		// center in the cell
+		SDL_Rect fit = get_fit_mode((SDL_Point){thumbnail->w, thumbnail->h}, (SDL_Point){cell.w, cell.h});
+		SDL_Rect dst = {.x = cell.x + fit.x, .y = cell.y + fit.y, .w = thumbnail->w, .h = thumbnail->h};
+		SDL_SetSurfaceBlendMode(thumbnail, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(thumbnail, NULL, sheet, &dst);
+		SDL_FreeSurface(thumbnail);
+	}
+
+	free(job.thumbnails);
+	return true;
+}
+
+SDL_Surface *montage_create(struct montage *montage, SDL_Point size) {
+	SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, size.x, size.y, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!sheet) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		return NULL;
+	}
+
+	bool *dirty = malloc(montage->count * sizeof(bool));
+	if (!dirty) {
+		warn("malloc");
+		SDL_FreeSurface(sheet);
+		return NULL;
+	}
+	for (size_t i = 0; i < montage->count; ++i) dirty[i] = true;
+
+	bool ok = montage_update(montage, sheet, dirty);
+	free(dirty);
+	if (!ok) {
+		SDL_FreeSurface(sheet);
+		return NULL;
+	}
+	return sheet;
+}
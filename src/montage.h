@@ -0,0 +1,23 @@
+#ifndef MONTAGE_H
+#define MONTAGE_H
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "image.h"
+
+// size of the sheet in window mode when none is given
+#define MONTAGE_DEFAULT_W (1280)
+#define MONTAGE_DEFAULT_H (720)
+
+struct montage {
+	char **files;
+	size_t count;
+	int cols, rows;
+	unsigned int threads;
+	struct load_options *load;
+};
+
+void montage_layout(struct montage *montage, char **files, size_t count, struct load_options *load, unsigned int threads);
+SDL_Rect montage_cell(struct montage *montage, SDL_Surface *sheet, size_t index);
+SDL_Surface *montage_create(struct montage *montage, SDL_Point size);
+bool montage_update(struct montage *montage, SDL_Surface *sheet, bool *dirty);
+#endif // MONTAGE_H
@@ -0,0 +1,440 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+#include "parallel.h"
+#include "pool.h"
+#include "region.h"
+#include "util.h"
+
+static unsigned int band_count(unsigned int threads, size_t units) {
+	// more bands than threads, so a band that is slow to decode doesn't leave the other cores idle
+	size_t bands = (size_t) threads * BANDS_PER_THREAD;
+	return (unsigned int) (bands < units ? bands : units);
+}
+
+#ifdef HAVE_LIBJPEG
+// restart markers split the entropy coded data into segments that are decoded independently,
+// so a band of whole mcu rows can be cut out into a jpeg of its own, with the same headers and a shorter height
+struct jpeg_split {
+	const uint8_t *data;
+	size_t sof;     // offset of the SOF marker
+	size_t headers; // offset where the entropy coded data starts
+	int w, h, mcu_h;
+	bool context;     // chroma is upsampled from the rows of mcus around it, so bands have to decode those too
+	size_t *segments; // offset where each restart segment starts, and one past the end of the last one
+	size_t *aligned;  // the segments that start a row of mcus, and one past the last segment
+	size_t *aligned_rows; // the row of mcus each of those starts, and the number of rows
+	size_t aligned_count;
+	size_t *bands;    // first aligned segment of each band, and aligned_count
+	unsigned int band_count;
+	SDL_Surface *surface;
+	atomic_bool failed;
+};
+
+static uint16_t get_be16(const uint8_t *p) {
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static bool parse_jpeg(const uint8_t *data, size_t size, struct jpeg_split *split, unsigned int *restart_interval) {
+	// finds the frame header, restart interval and start of scan, for sequential jpegs with one scan only
+	bool frame = false;
+	*restart_interval = 0;
+	size_t offset = 2;
+	while (offset + 4 <= size && data[offset] == 0xff) {
+		uint8_t marker = data[offset + 1];
+		if (marker == 0xff) {
+			++offset;
+			continue;
+		}
+		size_t len = get_be16(data + offset + 2);
+		if (len < 2 || offset + 2 + len > size) return false;
+		const uint8_t *segment = data + offset + 4;
+
+		if (marker == 0xc0 || marker == 0xc1) {
+			// baseline or extended huffman coded, with three components, so the output is rgb
+			if (len < 8 + 3 * 3 || segment[5] != 3) return false;
+			split->sof = offset;
+			split->h = get_be16(segment + 1);
+			split->w = get_be16(segment + 3);
+			int v_max = 1;
+			for (int c = 0; c < 3; ++c) {
+				int v = segment[6 + c * 3 + 1] & 0xf;
+				if (v > v_max) v_max = v;
+			}
+			split->mcu_h = 8 * v_max;
+			frame = true;
+		} else if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+			// progressive, lossless and arithmetic coding have no independent segments to split on
+			return false;
+		} else if (marker == 0xdd) {
+			if (len < 4) return false;
+			*restart_interval = get_be16(segment);
+		} else if (marker == 0xda) {
+			// all components have to be in this one scan
+			if (!frame || len < 3 || segment[0] != 3) return false;
+			split->headers = offset + 2 + len;
+			return split->w > 0 && split->h > 0 && *restart_interval > 0;
+		}
+		offset += 2 + len;
+	}
+	return false;
+}
+
+static size_t find_segments(const uint8_t *data, size_t size, size_t start, size_t *segments, size_t max) {
+	// offsets after each restart marker, stuffed 0xff00 bytes aren't markers
+	size_t count = 0;
+	segments[count++] = start;
+	const uint8_t *p = data + start, *end = data + size;
+	while ((p = memchr(p, 0xff, (size_t) (end - p))) && p + 1 < end) {
+		uint8_t marker = p[1];
+		if (marker >= 0xd0 && marker <= 0xd7) {
+			if (count >= max) return 0;
+			segments[count++] = (size_t) (p + 2 - data);
+			p += 2;
+		} else if (marker == 0x00 || marker == 0xff) {
+			++p;
+		} else {
+			// end of image
+			if (count >= max) return 0;
+			segments[count] = (size_t) (p - data);
+			return count;
+		}
+	}
+	return 0;
+}
+
+static int mcu_row_pixels(struct jpeg_split *split, size_t row) {
+	int y = (int) row * split->mcu_h;
+	return y < split->h ? y : split->h;
+}
+
+static bool decode_band(struct jpeg_split *split, unsigned int band, int top, uint8_t *jpeg, size_t jpeg_size) {
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error error;
+	cinfo.err = jpeg_quiet_error(&error);
+	if (setjmp(error.jmp)) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, jpeg, (unsigned long) jpeg_size);
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	// straight into the rows of the surface the band covers, the context rows above it are decoded into its first row
+	// and the ones below it aren't read at all
+	int first = mcu_row_pixels(split, split->aligned_rows[split->bands[band]]);
+	int end = mcu_row_pixels(split, split->aligned_rows[split->bands[band + 1]]);
+	if ((int) cinfo.output_width != split->w || top + (int) cinfo.output_height < end) longjmp(error.jmp, 1);
+	while (top + (int) cinfo.output_scanline < end) {
+		int y = top + (int) cinfo.output_scanline;
+		JSAMPROW row = (uint8_t *) split->surface->pixels + (size_t) (y > first ? y : first) * split->surface->pitch;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_abort_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
+
+static void jpeg_band_job(size_t index, void *data) {
+	struct jpeg_split *split = data;
+	unsigned int band = (unsigned int) index;
+	if (atomic_load(&split->failed)) return;
+
+	// the headers, with the height of the band, then its segments and an end of image marker
+	size_t start = split->bands[band], stop = split->bands[band + 1];
+	if (split->context && start > 0) --start;
+	if (split->context && stop < split->aligned_count) ++stop;
+	size_t first = split->aligned[start], last = split->aligned[stop];
+	size_t entropy_start = split->segments[first];
+	size_t entropy_end = split->segments[last] - (stop < split->aligned_count ? 2 : 0); // without the marker before the next band
+	size_t jpeg_size = split->headers + (entropy_end - entropy_start) + 2;
+	uint8_t *jpeg = malloc(jpeg_size);
+	if (!jpeg) {
+		atomic_store(&split->failed, true);
+		return;
+	}
+
+	memcpy(jpeg, split->data, split->headers);
+	int top = mcu_row_pixels(split, split->aligned_rows[start]);
+	int rows = mcu_row_pixels(split, split->aligned_rows[stop]) - top;
+	jpeg[split->sof + 5] = (uint8_t) (rows >> 8);
+	jpeg[split->sof + 6] = (uint8_t) rows;
+	uint8_t *entropy = jpeg + split->headers;
+	memcpy(entropy, split->data + entropy_start, entropy_end - entropy_start);
+	// restart markers count up from 0 again in every band
+	for (size_t segment = first + 1; segment < last; ++segment)
+		entropy[split->segments[segment] - 1 - entropy_start] = (uint8_t) (0xd0 + ((segment - first - 1) & 7));
+	jpeg[jpeg_size - 2] = 0xff;
+	jpeg[jpeg_size - 1] = 0xd9;
+
+	if (!decode_band(split, band, top, jpeg, jpeg_size)) atomic_store(&split->failed, true);
+	free(jpeg);
+}
+
+static SDL_Surface *decode_jpeg_parallel(const uint8_t *data, size_t size, unsigned int threads) {
+	struct jpeg_split split = {.data = data};
+	unsigned int restart_interval;
+	atomic_init(&split.failed, false);
+	if (!parse_jpeg(data, size, &split, &restart_interval)) return NULL;
+	if ((size_t) split.w * split.h < PARALLEL_MIN_PIXELS) return NULL;
+
+	// the restart interval is counted in mcus, a band has to start at the start of a row of them
+	int h_max = 1;
+	for (int c = 0; c < 3; ++c) {
+		int h = data[split.sof + 4 + 6 + c * 3 + 1] >> 4;
+		if (h > h_max) h_max = h;
+	}
+	split.context = split.mcu_h > 8;
+	size_t mcus_per_row = (size_t) (split.w + 8 * h_max - 1) / (8 * h_max);
+	size_t mcu_rows = (size_t) (split.h + split.mcu_h - 1) / split.mcu_h;
+	size_t segment_count = (mcus_per_row * mcu_rows + restart_interval - 1) / restart_interval;
+
+	SDL_Surface *surface = NULL;
+	split.segments = malloc(sizeof(size_t) * (segment_count + 1));
+	split.aligned = malloc(sizeof(size_t) * (segment_count + 1));
+	split.aligned_rows = malloc(sizeof(size_t) * (segment_count + 1));
+	split.bands = malloc(sizeof(size_t) * (segment_count + 1));
+	if (!split.segments || !split.aligned || !split.aligned_rows || !split.bands) goto end;
+	if (find_segments(data, size, split.headers, split.segments, segment_count + 1) != segment_count) goto end;
+
+	for (size_t segment = 0; segment < segment_count; ++segment) {
+		size_t mcu = segment * restart_interval;
+		if (mcu % mcus_per_row != 0) continue;
+		split.aligned[split.aligned_count] = segment;
+		split.aligned_rows[split.aligned_count] = mcu / mcus_per_row;
+		++split.aligned_count;
+	}
+	split.aligned[split.aligned_count] = segment_count;
+	split.aligned_rows[split.aligned_count] = mcu_rows;
+
+	// cut at the first aligned segment at or after each even share of the rows
+	unsigned int wanted = band_count(threads, mcu_rows);
+	size_t next_row = 0;
+	for (size_t i = 0; i < split.aligned_count; ++i) {
+		if (split.aligned_rows[i] < next_row) continue;
+		split.bands[split.band_count++] = i;
+		next_row = mcu_rows * split.band_count / wanted;
+	}
+	split.bands[split.band_count] = split.aligned_count;
+	if (split.band_count < 2) goto end;
+
+	split.surface = SDL_CreateRGBSurfaceWithFormat(0, split.w, split.h, 24, SDL_PIXELFORMAT_RGB24);
+	if (!split.surface) goto end;
+	if (!pool_run(split.band_count, threads, jpeg_band_job, &split) || atomic_load(&split.failed)) {
+		SDL_FreeSurface(split.surface);
+		goto end;
+	}
+	surface = split.surface;
+
+end:
+	free(split.segments);
+	free(split.aligned);
+	free(split.aligned_rows);
+	free(split.bands);
+	return surface;
+}
+#endif
+
+#ifdef HAVE_LIBTIFF
+// every thread opens the tiff on its own, reading from the same buffer
+struct tiff_source {
+	const uint8_t *data;
+	size_t size;
+	toff_t offset;
+};
+
+static tmsize_t tiff_read(thandle_t handle, void *buf, tmsize_t size) {
+	struct tiff_source *source = handle;
+	if (size < 0 || source->offset >= source->size) return 0;
+	size_t n = source->size - source->offset;
+	if ((size_t) size < n) n = (size_t) size;
+	memcpy(buf, source->data + source->offset, n);
+	source->offset += n;
+	return (tmsize_t) n;
+}
+
+static tmsize_t tiff_write(thandle_t handle, void *buf, tmsize_t size) {
+	(void) handle;
+	(void) buf;
+	(void) size;
+	return 0;
+}
+
+static toff_t tiff_seek(thandle_t handle, toff_t offset, int whence) {
+	struct tiff_source *source = handle;
+	if (whence == SEEK_CUR) offset += source->offset;
+	else if (whence == SEEK_END)
+		offset += source->size;
+	source->offset = offset;
+	return offset;
+}
+
+static int tiff_close(thandle_t handle) {
+	(void) handle;
+	return 0;
+}
+
+static toff_t tiff_size(thandle_t handle) {
+	return ((struct tiff_source *) handle)->size;
+}
+
+static int tiff_map(thandle_t handle, void **base, toff_t *size) {
+	// already in memory, so libtiff can read strips without copying them
+	struct tiff_source *source = handle;
+	*base = (void *) source->data;
+	*size = source->size;
+	return 1;
+}
+
+static void tiff_unmap(thandle_t handle, void *base, toff_t size) {
+	(void) handle;
+	(void) base;
+	(void) size;
+}
+
+// handlers can only be set for one file since libtiff 4.5, older versions print to stderr
+#if TIFFLIB_VERSION >= 20221213
+#define TIFF_QUIET
+#endif
+
+#ifdef TIFF_QUIET
+static int tiff_ignore(TIFF *tif, void *data, const char *module, const char *fmt, va_list ap) {
+	// any problem that matters makes it fall back to SDL_image, which reports errors itself
+	(void) tif;
+	(void) data;
+	(void) module;
+	(void) fmt;
+	(void) ap;
+	return 1;
+}
+#endif
+
+static TIFF *open_tiff_source(struct tiff_source *source) {
+	source->offset = 0;
+#ifdef TIFF_QUIET
+	// the global handlers belong to the program, so they aren't touched
+	TIFFOpenOptions *opts = TIFFOpenOptionsAlloc();
+	if (!opts) return NULL;
+	TIFFOpenOptionsSetErrorHandlerExtR(opts, tiff_ignore, NULL);
+	TIFFOpenOptionsSetWarningHandlerExtR(opts, tiff_ignore, NULL);
+	TIFF *tif = TIFFClientOpenExt("tiff", "r", source, tiff_read, tiff_write, tiff_seek, tiff_close, tiff_size, tiff_map, tiff_unmap, opts);
+	TIFFOpenOptionsFree(opts);
+	return tif;
+#else
+	return TIFFClientOpen("tiff", "r", source, tiff_read, tiff_write, tiff_seek, tiff_close, tiff_size, tiff_map, tiff_unmap);
+#endif
+}
+
+struct tiff_split {
+	const uint8_t *data;
+	size_t size;
+	bool tiled;
+	uint32_t w, h, unit_w, unit_h; // units are strips or tiles
+	uint32_t units, units_across;
+	unsigned int band_count;
+	SDL_Surface *surface;
+	atomic_bool failed;
+};
+
+static void tiff_band_job(size_t index, void *data) {
+	// decodes an even share of the strips or tiles, reading them as rgba, whatever they are stored as
+	struct tiff_split *split = data;
+	if (atomic_load(&split->failed)) return;
+	uint32_t first = (uint32_t) ((size_t) split->units * index / split->band_count);
+	uint32_t last = (uint32_t) ((size_t) split->units * (index + 1) / split->band_count);
+
+	struct tiff_source source = {.data = split->data, .size = split->size};
+	TIFF *tif = open_tiff_source(&source);
+	uint32_t *raster = malloc(sizeof(uint32_t) * split->unit_w * split->unit_h);
+	if (!tif || !raster) goto fail;
+
+	for (uint32_t unit = first; unit < last; ++unit) {
+		uint32_t x = split->tiled ? unit % split->units_across * split->unit_w : 0;
+		uint32_t y = (split->tiled ? unit / split->units_across : unit) * split->unit_h;
+		if (split->tiled ? !TIFFReadRGBATile(tif, x, y, raster) : !TIFFReadRGBAStrip(tif, y, raster)) goto fail;
+
+		// the raster is bottom up, a whole tile even at the edges, but only the rows there are for the last strip
+		uint32_t w = split->w - x < split->unit_w ? split->w - x : split->unit_w;
+		uint32_t h = split->h - y < split->unit_h ? split->h - y : split->unit_h;
+		uint32_t raster_h = split->tiled ? split->unit_h : h;
+		uint32_t raster_w = split->tiled ? split->unit_w : split->w;
+		for (uint32_t row = 0; row < h; ++row) {
+			uint8_t *dst = (uint8_t *) split->surface->pixels + (size_t) (y + row) * split->surface->pitch + (size_t) x * 4;
+			memcpy(dst, raster + (size_t) (raster_h - 1 - row) * raster_w, (size_t) w * 4);
+		}
+	}
+	free(raster);
+	TIFFClose(tif);
+	return;
+
+fail:
+	atomic_store(&split->failed, true);
+	free(raster);
+	if (tif) TIFFClose(tif);
+}
+
+static SDL_Surface *decode_tiff_parallel(const uint8_t *data, size_t size, unsigned int threads) {
+	struct tiff_split split = {.data = data, .size = size};
+	atomic_init(&split.failed, false);
+	struct tiff_source source = {.data = data, .size = size};
+	TIFF *tif = open_tiff_source(&source);
+	if (!tif) return NULL;
+
+	// the rgba functions read one strip or tile the right way up, the orientation of the whole image is left to SDL_image
+	char message[1024];
+	uint16_t orientation;
+	bool ok = TIFFRGBAImageOK(tif, message) && TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &split.w) && TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &split.h) &&
+	          TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &orientation) && orientation == ORIENTATION_TOPLEFT;
+	if (ok && (size_t) split.w * split.h < PARALLEL_MIN_PIXELS) ok = false;
+	if (ok) {
+		split.tiled = TIFFIsTiled(tif);
+		if (split.tiled) {
+			ok = TIFFGetField(tif, TIFFTAG_TILEWIDTH, &split.unit_w) && TIFFGetField(tif, TIFFTAG_TILELENGTH, &split.unit_h);
+			split.units = TIFFNumberOfTiles(tif);
+		} else {
+			split.unit_w = split.w;
+			ok = TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &split.unit_h);
+			if (split.unit_h > split.h) split.unit_h = split.h;
+			split.units = TIFFNumberOfStrips(tif);
+		}
+	}
+	TIFFClose(tif);
+	if (!ok || split.unit_w == 0 || split.unit_h == 0 || split.units < 2) return NULL;
+	split.units_across = (split.w + split.unit_w - 1) / split.unit_w;
+	// planar images have a strip per channel
+	if (split.units != split.units_across * ((split.h + split.unit_h - 1) / split.unit_h)) return NULL;
+
+	split.band_count = band_count(threads, split.units);
+	split.surface = SDL_CreateRGBSurfaceWithFormat(0, (int) split.w, (int) split.h, 32, SDL_PIXELFORMAT_ABGR8888);
+	if (!split.surface) return NULL;
+	if (!pool_run(split.band_count, threads, tiff_band_job, &split) || atomic_load(&split.failed)) {
+		SDL_FreeSurface(split.surface);
+		return NULL;
+	}
+	return split.surface;
+}
+#endif
+
+SDL_Surface *decode_parallel(const uint8_t *data, size_t size, unsigned int threads) {
+	// decodes large images split into parts on every core, for the formats that allow it, NULL otherwise
+	(void) data;
+	(void) size;
+	if (threads == 0) threads = pool_default_threads();
+	if (threads < 2) return NULL;
+#ifdef HAVE_LIBJPEG
+	if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) return decode_jpeg_parallel(data, size, threads);
+#endif
+#ifdef HAVE_LIBTIFF
+	if (size >= 4 && (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0)) return decode_tiff_parallel(data, size, threads);
+#endif
+	return NULL;
+}
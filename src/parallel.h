@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// smaller images decode fast enough on one core
+#define PARALLEL_MIN_PIXELS (4 << 20)
+#define BANDS_PER_THREAD (4)
+
+SDL_Surface *decode_parallel(const uint8_t *data, size_t size, unsigned int threads);
+#endif // PARALLEL_H
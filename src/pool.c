@@ -0,0 +1,61 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "pool.h"
+
+struct pool {
+	atomic_size_t next; // next job to hand out
+	size_t jobs;
+	void (*job)(size_t index, void *data);
+	void *data;
+};
+
+static void *worker(void *arg) {
+	struct pool *pool = arg;
+	// idle threads take the next job, so a slow job never holds up the others,
+	// and jobs start in order, which lets callers bound how far ahead they run
+	for (size_t i; (i = atomic_fetch_add(&pool->next, 1)) < pool->jobs;) {
+		pool->job(i, pool->data);
+	}
+	return NULL;
+}
+
+unsigned int pool_default_threads() {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (unsigned int) cpus : 1;
+}
+
+bool pool_run(size_t jobs, unsigned int threads, void (*job)(size_t index, void *data), void *data) {
+	// runs job for every index below jobs, the calling thread is one of the workers
+	struct pool pool = {.jobs = jobs, .job = job, .data = data};
+	atomic_init(&pool.next, 0);
+
+	if (threads < 1) threads = 1;
+	if (threads > jobs) threads = jobs > 0 ? (unsigned int) jobs : 1;
+
+	pthread_t *tids = NULL;
+	unsigned int started = 0;
+	if (threads > 1) {
+		tids = malloc(sizeof(pthread_t) * (threads - 1));
+		if (!tids) {
+			warn("malloc");
+			return false;
+		}
+		for (; started < threads - 1; ++started) {
+			if (pthread_create(&tids[started], NULL, worker, &pool) != 0) {
+				// carry on with the threads we have
+				warnx("Failed to create thread");
+				break;
+			}
+		}
+	}
+
+	worker(&pool);
+
+	for (unsigned int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+	free(tids);
+	return true;
+}
@@ -0,0 +1,8 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdbool.h>
+#include <stddef.h>
+
+unsigned int pool_default_threads();
+bool pool_run(size_t jobs, unsigned int threads, void (*job)(size_t index, void *data), void *data);
+#endif // POOL_H
@@ -0,0 +1,254 @@
+#include <ctype.h>
+#include <err.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#define REGION_PNG
+#endif
+
+#include "region.h"
+#include "arg.h"
+#include "util.h"
+
+#ifdef HAVE_LIBJPEG
+// cropping and skipping scanlines are libjpeg-turbo extensions
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define REGION_JPEG
+#endif
+#endif
+
+bool parse_region(char *str, SDL_Rect *region) {
+	// x,y,w,h with the size at least 1 pixel
+	long nums[4];
+	if (!parse_num_array(str, nums, 4)) return false;
+	if (nums[0] < 0 || nums[1] < 0 || nums[2] <= 0 || nums[3] <= 0) return false;
+	for (int i = 0; i < 4; ++i)
+		if (nums[i] > INT_MAX) return false;
+	*region = (SDL_Rect){.x = (int) nums[0], .y = (int) nums[1], .w = (int) nums[2], .h = (int) nums[3]};
+	return true;
+}
+
+bool read_region_file(char *filename, SDL_Rect *region) {
+	// the first line of the file is the region, so it can be changed while the image is shown
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		warn("%s", filename);
+		return false;
+	}
+
+	char line[256];
+	bool ret = fgets(line, sizeof(line), fp) != NULL;
+	if (ferror(fp)) warn("%s", filename);
+	fclose(fp);
+	if (!ret) return false;
+
+	// strip whitespace
+	char *start = line;
+	while (isspace((unsigned char) *start)) ++start;
+	char *end = start + strlen(start);
+	while (end > start && isspace((unsigned char) end[-1])) --end;
+	*end = '\0';
+
+	if (!parse_region(start, region)) {
+		eprintf("%s: Invalid crop region\n", filename);
+		return false;
+	}
+	return true;
+}
+
+bool clip_region(SDL_Rect *region, int w, int h) {
+	// clip a region to an image of size w by h, false if nothing is left
+	SDL_Rect image = {0, 0, w, h};
+	SDL_Rect clipped;
+	if (!SDL_IntersectRect(region, &image, &clipped)) {
+		eprintf("Crop region is outside of the image\n");
+		return false;
+	}
+	*region = clipped;
+	return true;
+}
+
+SDL_Surface *crop_surface(SDL_Surface *surface, SDL_Rect *region) {
+	// get a copy of part of a surface, for formats that can only be decoded whole
+	SDL_Rect rect = *region;
+	if (!clip_region(&rect, surface->w, surface->h)) return NULL;
+
+	SDL_Surface *cropped = SDL_CreateRGBSurfaceWithFormat(0, rect.w, rect.h, surface->format->BitsPerPixel, surface->format->format);
+	if (!cropped) {
+		eprintf("Failed to create surface: %s\n", SDL_GetError());
+		return NULL;
+	}
+	if (surface->format->palette) SDL_SetSurfacePalette(cropped, surface->format->palette);
+
+	SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+	if (SDL_BlitSurface(surface, &rect, cropped, NULL) != 0) {
+		eprintf("Failed to crop surface: %s\n", SDL_GetError());
+		SDL_FreeSurface(cropped);
+		return NULL;
+	}
+	return cropped;
+}
+
+#ifdef HAVE_LIBJPEG
+static void jpeg_error_exit(j_common_ptr cinfo) {
+	// the default handler exits the process
+	struct jpeg_error *error = (struct jpeg_error *) cinfo->err;
+	longjmp(error->jmp, 1);
+}
+
+static void jpeg_output_message(j_common_ptr cinfo) {
+	(void) cinfo; // decoding falls back to SDL_image, which reports errors itself
+}
+
+struct jpeg_error_mgr *jpeg_quiet_error(struct jpeg_error *error) {
+	jpeg_std_error(&error->mgr);
+	error->mgr.error_exit = jpeg_error_exit;
+	error->mgr.output_message = jpeg_output_message;
+	return &error->mgr;
+}
+#endif
+
+#ifdef REGION_JPEG
+static SDL_Surface *decode_jpeg_region(const uint8_t *data, size_t size, SDL_Rect *region) {
+	// decodes only the rows of the region, and only the blocks of its columns
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error error;
+	SDL_Surface *volatile surface = NULL;
+	uint8_t *volatile row = NULL;
+
+	cinfo.err = jpeg_quiet_error(&error);
+	if (setjmp(error.jmp)) {
+		if (surface) SDL_FreeSurface(surface);
+		free(row);
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, data, (unsigned long) size);
+	jpeg_read_header(&cinfo, TRUE);
+	if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		// can't be converted to rgb by libjpeg
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+	cinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	SDL_Rect rect = *region;
+	if (!clip_region(&rect, (int) cinfo.output_width, (int) cinfo.output_height)) longjmp(error.jmp, 1);
+
+	// the decoder can only start at a block boundary, so it may decode a few columns more
+	JDIMENSION x = (JDIMENSION) rect.x, w = (JDIMENSION) rect.w;
+	jpeg_crop_scanline(&cinfo, &x, &w);
+	size_t skip_x = (size_t) rect.x - x;
+
+	surface = SDL_CreateRGBSurfaceWithFormat(0, rect.w, rect.h, 24, SDL_PIXELFORMAT_RGB24);
+	row = malloc((size_t) w * 3);
+	if (!surface || !row) longjmp(error.jmp, 1);
+
+	if (rect.y > 0) jpeg_skip_scanlines(&cinfo, (JDIMENSION) rect.y);
+	for (int y = 0; y < rect.h; ++y) {
+		JSAMPROW rows[1] = {row};
+		if (jpeg_read_scanlines(&cinfo, rows, 1) != 1) longjmp(error.jmp, 1);
+		memcpy((uint8_t *) surface->pixels + (size_t) y * surface->pitch, row + skip_x * 3, (size_t) rect.w * 3);
+	}
+
+	// the rest of the image is never decoded
+	free(row);
+	jpeg_destroy_decompress(&cinfo);
+	return surface;
+}
+#endif
+
+#ifdef REGION_PNG
+struct png_reader {
+	const uint8_t *data;
+	size_t size, offset;
+};
+
+static void png_read_mem(png_structp png, png_bytep out, png_size_t len) {
+	struct png_reader *reader = png_get_io_ptr(png);
+	if (len > reader->size - reader->offset) png_error(png, "unexpected end of file");
+	memcpy(out, reader->data + reader->offset, len);
+	reader->offset += len;
+}
+
+static void png_warning_ignore(png_structp png, png_const_charp message) {
+	(void) png;
+	(void) message;
+}
+
+static SDL_Surface *decode_png_region(const uint8_t *data, size_t size, SDL_Rect *region) {
+	// rows before the region still have to be decompressed, but they aren't kept, and rows after it aren't read
+	struct png_reader reader = {.data = data, .size = size};
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, png_warning_ignore);
+	if (!png) return NULL;
+	png_infop info = png_create_info_struct(png);
+	if (!info) {
+		png_destroy_read_struct(&png, NULL, NULL);
+		return NULL;
+	}
+
+	SDL_Surface *volatile surface = NULL;
+	uint8_t *volatile row = NULL;
+	if (setjmp(png_jmpbuf(png))) {
+		if (surface) SDL_FreeSurface(surface);
+		free(row);
+		png_destroy_read_struct(&png, &info, NULL);
+		return NULL;
+	}
+
+	png_set_read_fn(png, &reader, png_read_mem);
+	png_read_info(png, info);
+
+	if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+		// every pass covers the whole image
+		png_destroy_read_struct(&png, &info, NULL);
+		return NULL;
+	}
+
+	// always read 8-bit rgba
+	png_set_expand(png);
+	png_set_strip_16(png);
+	png_set_gray_to_rgb(png);
+	png_set_add_alpha(png, 0xff, PNG_FILLER_AFTER);
+	png_read_update_info(png, info);
+
+	int w = (int) png_get_image_width(png, info), h = (int) png_get_image_height(png, info);
+	SDL_Rect rect = *region;
+	if (!clip_region(&rect, w, h)) longjmp(png_jmpbuf(png), 1);
+
+	surface = SDL_CreateRGBSurfaceWithFormat(0, rect.w, rect.h, 32, SDL_PIXELFORMAT_RGBA32);
+	row = malloc(png_get_rowbytes(png, info));
+	if (!surface || !row) longjmp(png_jmpbuf(png), 1);
+
+	for (int y = 0; y < rect.y + rect.h; ++y) {
+		png_read_row(png, row, NULL);
+		if (y >= rect.y) memcpy((uint8_t *) surface->pixels + (size_t) (y - rect.y) * surface->pitch, row + (size_t) rect.x * 4, (size_t) rect.w * 4);
+	}
+
+	free(row);
+	png_destroy_read_struct(&png, &info, NULL);
+	return surface;
+}
+#endif
+
+SDL_Surface *decode_region(const uint8_t *data, size_t size, SDL_Rect *region) {
+	// decodes only part of an image, for the formats that allow it, NULL otherwise
+	(void) data;
+	(void) size;
+	(void) region;
+#ifdef REGION_JPEG
+	if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) return decode_jpeg_region(data, size, region);
+#endif
+#ifdef REGION_PNG
+	if (size >= 8 && png_sig_cmp(data, 0, 8) == 0) return decode_png_region(data, size, region);
+#endif
+	return NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef REGION_H
+#define REGION_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+#include <jpeglib.h>
+
+// makes libjpeg jump back to jmp on errors instead of exiting, without printing anything
+struct jpeg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jmp;
+};
+
+struct jpeg_error_mgr *jpeg_quiet_error(struct jpeg_error *error);
+#endif
+
+bool parse_region(char *str, SDL_Rect *region);
+bool read_region_file(char *filename, SDL_Rect *region);
+bool clip_region(SDL_Rect *region, int w, int h);
+SDL_Surface *crop_surface(SDL_Surface *surface, SDL_Rect *region);
+SDL_Surface *decode_region(const uint8_t *data, size_t size, SDL_Rect *region);
+#endif // REGION_H
@@ -0,0 +1,183 @@
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "util.h"
+
+static const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+struct buffer {
+	uint8_t *data;
+	size_t size, alloc;
+};
+
+static bool read_full(int fd, void *buf, size_t len) {
+	// returns false on end of file or error
+	for (uint8_t *p = buf; len > 0;) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) warn("stream");
+		if (n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool buffer_read(struct buffer *buffer, int fd, size_t len) {
+	// append len bytes from fd to the buffer
+	if (buffer->size + len > INT32_MAX) {
+		eprintf("Frame is too large\n");
+		return false;
+	}
+	if (buffer->size + len > buffer->alloc) {
+		size_t alloc = buffer->alloc ? buffer->alloc : 4096;
+		while (alloc < buffer->size + len) alloc *= 2;
+		uint8_t *data = realloc(buffer->data, alloc);
+		if (!data) {
+			warn("realloc");
+			return false;
+		}
+		buffer->data = data;
+		buffer->alloc = alloc;
+	}
+	if (!read_full(fd, buffer->data + buffer->size, len)) return false;
+	buffer->size += len;
+	return true;
+}
+
+static uint32_t read_be32(uint8_t *p) {
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static bool read_frame(struct stream *stream, struct buffer *buffer) {
+	// reads exactly one frame, only parsing as much as is needed to find where it ends
+	buffer->size = 0;
+
+	struct raw_format *raw = stream->load->raw;
+	if (raw) {
+		// raw frames are all the same size
+		size_t size = (size_t) raw->w * raw->h * SDL_BYTESPERPIXEL(raw->format);
+		return buffer_read(buffer, stream->fd, size);
+	}
+
+	if (!buffer_read(buffer, stream->fd, 4)) return false;
+
+	if (memcmp(buffer->data, png_signature, 4) != 0) {
+		// any other format has to be prefixed with its length, as a 32-bit big endian integer
+		uint32_t len = read_be32(buffer->data);
+		buffer->size = 0;
+		return len > 0 && buffer_read(buffer, stream->fd, len);
+	}
+
+	// png: signature, then chunks of length, type, data and crc until IEND
+	if (!buffer_read(buffer, stream->fd, 4)) return false;
+	if (memcmp(buffer->data, png_signature, 8) != 0) {
+		eprintf("Invalid PNG signature in stream\n");
+		return false;
+	}
+	for (;;) {
+		size_t offset = buffer->size;
+		if (!buffer_read(buffer, stream->fd, 8)) return false;
+		uint32_t len = read_be32(buffer->data + offset);
+		bool end = memcmp(buffer->data + offset + 4, "IEND", 4) == 0;
+		if (!buffer_read(buffer, stream->fd, (size_t) len + 4)) return false;
+		if (end) return true;
+	}
+}
+
+static int stream_thread(void *data) {
+	struct stream *stream = data;
+	struct buffer buffer = {0};
+
+	while (read_frame(stream, &buffer)) {
+		// hand the frame over as is, and keep reading into a new buffer
+		uint8_t *frame = buffer.data;
+		size_t frame_size = buffer.size;
+		buffer = (struct buffer){0};
+
+		SDL_LockMutex(stream->mutex);
+		bool notify = !stream->frame;
+		if (stream->frame) {
+			// the previous frame was never shown, it is stale now
+			free(stream->frame);
+			++stream->dropped;
+		}
+		stream->frame = frame;
+		stream->frame_size = frame_size;
+		SDL_CondSignal(stream->cond);
+		SDL_UnlockMutex(stream->mutex);
+
+		if (notify) {
+			// one event until the frame is taken, however many frames arrive before that
+			SDL_Event event = {0};
+			event.type = stream->event_type;
+			SDL_PushEvent(&event);
+		}
+	}
+
+	free(buffer.data);
+
+	SDL_LockMutex(stream->mutex);
+	stream->eof = true;
+	SDL_CondSignal(stream->cond);
+	SDL_UnlockMutex(stream->mutex);
+	return 0;
+}
+
+bool stream_start(struct stream *stream, int fd, struct load_options *load, Uint32 event_type) {
+	*stream = (struct stream){.fd = fd, .load = load, .event_type = event_type};
+
+	stream->mutex = SDL_CreateMutex();
+	stream->cond = SDL_CreateCond();
+	if (!stream->mutex || !stream->cond) {
+		eprintf("Failed to create mutex: %s\n", SDL_GetError());
+		return false;
+	}
+
+	stream->thread = SDL_CreateThread(stream_thread, "stream", stream);
+	if (!stream->thread) {
+		eprintf("Failed to create thread: %s\n", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+bool stream_ended(struct stream *stream) {
+	// whether there will be no more frames to take
+	SDL_LockMutex(stream->mutex);
+	bool ended = stream->eof && !stream->frame;
+	SDL_UnlockMutex(stream->mutex);
+	return ended;
+}
+
+SDL_Surface *stream_take(struct stream *stream, bool wait) {
+	// decodes the newest frame, NULL if there is none yet, or none ever with wait set
+	SDL_LockMutex(stream->mutex);
+	while (wait && !stream->frame && !stream->eof) SDL_CondWait(stream->cond, stream->mutex);
+	uint8_t *frame = stream->frame;
+	size_t frame_size = stream->frame_size;
+	stream->frame = NULL;
+	SDL_UnlockMutex(stream->mutex);
+
+	if (!frame) return NULL;
+	return read_data(frame, frame_size, stream->load);
+}
+
+void stream_free(struct stream *stream) {
+	if (stream->thread) {
+		// the thread may be blocked reading, which only ends with the input
+		SDL_DetachThread(stream->thread);
+		stream->thread = NULL;
+		return; // the thread still uses the mutex
+	}
+	if (stream->mutex) SDL_DestroyMutex(stream->mutex);
+	if (stream->cond) SDL_DestroyCond(stream->cond);
+	free(stream->frame);
+	stream->mutex = NULL;
+	stream->cond = NULL;
+	stream->frame = NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "image.h"
+
+struct stream {
+	int fd;
+	struct load_options *load; // frames are raw pixels if load->raw is set, otherwise images
+	Uint32 event_type;
+	SDL_Thread *thread;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	uint8_t *frame; // newest complete frame that hasn't been shown yet
+	size_t frame_size;
+	unsigned long dropped;
+	bool eof;
+};
+
+bool stream_start(struct stream *stream, int fd, struct load_options *load, Uint32 event_type);
+bool stream_ended(struct stream *stream);
+SDL_Surface *stream_take(struct stream *stream, bool wait);
+void stream_free(struct stream *stream);
+#endif // STREAM_H
@@ -1,23 +1,169 @@
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <termios.h>
+#include <unistd.h>
+
 #include "term.h"
 #include "util.h"
+#include "image.h"
 #include <SDL2/SDL_image.h>
 #include "color.h"
 
-static bool get_pixel(SDL_Surface *surface, struct position position, struct color *color) {
-	Uint8 *p = &((Uint8 *) surface->pixels)[position.y * surface->pitch + position.x * surface->format->BytesPerPixel];
-	Uint32 c = *(Uint32 *) p;
+// the glyph for each pattern of foreground pixels in a cell, bit i is pixel i counting left to right, top to bottom
+static const char *const half_glyphs[4] = {" ", "\u2580", "\u2584", "\u2588"};
 
-	// Extract RGBA values
-	SDL_GetRGBA(c, surface->format, &color->r, &color->g, &color->b, &color->a);
+static const char *const quadrant_glyphs[16] = {
+        " ", "\u2598", "\u259d", "\u2580", "\u2596", "\u258c", "\u259e", "\u259b",
+        "\u2597", "\u259a", "\u2590", "\u259c", "\u2584", "\u2599", "\u259f", "\u2588",
+};
 
-	return true;
+// the sextant block leaves out the patterns that already had a character: empty, full, and the left and right halves
+static const char *const sextant_glyphs[64] = {
+        " ", "\U0001FB00", "\U0001FB01", "\U0001FB02", "\U0001FB03", "\U0001FB04", "\U0001FB05", "\U0001FB06",
+        "\U0001FB07", "\U0001FB08", "\U0001FB09", "\U0001FB0A", "\U0001FB0B", "\U0001FB0C", "\U0001FB0D", "\U0001FB0E",
+        "\U0001FB0F", "\U0001FB10", "\U0001FB11", "\U0001FB12", "\U0001FB13", "\u258c", "\U0001FB14", "\U0001FB15",
+        "\U0001FB16", "\U0001FB17", "\U0001FB18", "\U0001FB19", "\U0001FB1A", "\U0001FB1B", "\U0001FB1C", "\U0001FB1D",
+        "\U0001FB1E", "\U0001FB1F", "\U0001FB20", "\U0001FB21", "\U0001FB22", "\U0001FB23", "\U0001FB24", "\U0001FB25",
+        "\U0001FB26", "\U0001FB27", "\u2590", "\U0001FB28", "\U0001FB29", "\U0001FB2A", "\U0001FB2B", "\U0001FB2C",
+        "\U0001FB2D", "\U0001FB2E", "\U0001FB2F", "\U0001FB30", "\U0001FB31", "\U0001FB32", "\U0001FB33", "\U0001FB34",
+        "\U0001FB35", "\U0001FB36", "\U0001FB37", "\U0001FB38", "\U0001FB39", "\U0001FB3A", "\U0001FB3B", "\u2588",
+};
+
+static const struct {
+	const char *name;
+	enum glyph_mode glyphs;
+	SDL_Point cell;
+	const char *const *table;
+} glyph_modes[] = {
+        {"space",    GLYPH_SPACE,    {1, 1}, half_glyphs    },
+        {"half",     GLYPH_HALF,     {1, 2}, half_glyphs    },
+        {"quadrant", GLYPH_QUADRANT, {2, 2}, quadrant_glyphs},
+        {"sextant",  GLYPH_SEXTANT,  {2, 3}, sextant_glyphs },
+};
+
+bool parse_glyph_mode(const char *str, enum glyph_mode *glyphs) {
+	for (size_t i = 0; i < sizeof(glyph_modes) / sizeof(glyph_modes[0]); ++i) {
+		if (strcasecmp(str, glyph_modes[i].name) == 0) {
+			*glyphs = glyph_modes[i].glyphs;
+			return true;
+		}
+	}
+	return false;
 }
 
-static void print_color(struct color color, bool fg, enum bit_depth bit_depth, FILE *fp) {
+SDL_Point glyph_cell_size(enum glyph_mode glyphs) {
+	return glyph_modes[glyphs].cell;
+}
+
+SDL_Point glyph_fit_size(SDL_Point size, enum glyph_mode glyphs) {
+	// a cell is about twice as tall as it is wide, so scale the image to make its pixels come out square
+	SDL_Point cell = glyph_cell_size(glyphs);
+	return (SDL_Point){size.x * 2 * cell.x, size.y * cell.y};
+}
+
+// cells are fitted this many at a time, small enough to stay in cache and for the arrays to live on the stack
+#define CELL_CHUNK (128)
+
+// planar copies of a run of cells, each array has one value per cell so every step is a straight loop over them
+struct cell_chunk {
+	size_t cols;
+	int pixels; // per cell
+	uint16_t channels[GLYPH_MAX_PIXELS][3][CELL_CHUNK];
+	uint16_t sum[3][CELL_CHUNK], min[3][CELL_CHUNK], max[3][CELL_CHUNK];
+	uint16_t pick[3][CELL_CHUNK];    // 1 for the channel with the widest range, which the pixels are split on
+	uint16_t threshold[CELL_CHUNK];  // the sum of that channel, a pixel is in the foreground if n times its value is more
+	uint16_t fg_sum[3][CELL_CHUNK], fg_count[CELL_CHUNK], mask[CELL_CHUNK];
+	struct color fg[CELL_CHUNK], bg[CELL_CHUNK];
+};
+
+static void load_cell_chunk(struct cell_chunk *chunk, SDL_Surface *surface, SDL_Point cell, int x, int y) {
+	// pixels past the edge of the surface repeat the last row or column
+	int cols = (surface->w - x * cell.x + cell.x - 1) / cell.x;
+	chunk->cols = cols < CELL_CHUNK ? (size_t) cols : CELL_CHUNK;
+	chunk->pixels = cell.x * cell.y;
+	for (int dy = 0, i = 0; dy < cell.y; ++dy) {
+		int py = y + dy < surface->h ? y + dy : surface->h - 1;
+		const Uint32 *pixels = (const Uint32 *) ((const Uint8 *) surface->pixels + (size_t) py * surface->pitch);
+		for (int dx = 0; dx < cell.x; ++dx, ++i) {
+			for (size_t c = 0; c < chunk->cols; ++c) {
+				int px = (x + (int) c) * cell.x + dx;
+				Uint32 p = pixels[px < surface->w ? px : surface->w - 1];
+				chunk->channels[i][0][c] = (uint16_t) (p >> 24 & 0xff);
+				chunk->channels[i][1][c] = (uint16_t) (p >> 16 & 0xff);
+				chunk->channels[i][2][c] = (uint16_t) (p >> 8 & 0xff);
+			}
+		}
+	}
+}
+
+static void fit_cell_chunk(struct cell_chunk *chunk) {
+	// picks two colours and a glyph for every cell: the pixels are split in two on the channel that varies the most,
+	// at its mean, and each side gets the average of its pixels. written without branches, so the loops vectorize
+	size_t cols = chunk->cols;
+	int n = chunk->pixels;
+
+	for (int c = 0; c < 3; ++c) {
+		for (size_t x = 0; x < cols; ++x) {
+			chunk->sum[c][x] = chunk->min[c][x] = chunk->max[c][x] = chunk->channels[0][c][x];
+		}
+		for (int i = 1; i < n; ++i) {
+			for (size_t x = 0; x < cols; ++x) {
+				uint16_t v = chunk->channels[i][c][x];
+				chunk->sum[c][x] += v;
+				chunk->min[c][x] = v < chunk->min[c][x] ? v : chunk->min[c][x];
+				chunk->max[c][x] = v > chunk->max[c][x] ? v : chunk->max[c][x];
+			}
+		}
+	}
+
+	for (size_t x = 0; x < cols; ++x) {
+		uint16_t range_r = chunk->max[0][x] - chunk->min[0][x], range_g = chunk->max[1][x] - chunk->min[1][x], range_b = chunk->max[2][x] - chunk->min[2][x];
+		uint16_t g = range_g > range_r, b = range_b > (g ? range_g : range_r);
+		chunk->pick[0][x] = (uint16_t) (!g & !b);
+		chunk->pick[1][x] = (uint16_t) (g & !b);
+		chunk->pick[2][x] = b;
+		chunk->threshold[x] = (uint16_t) (chunk->sum[0][x] * chunk->pick[0][x] + chunk->sum[1][x] * chunk->pick[1][x] + chunk->sum[2][x] * chunk->pick[2][x]);
+		chunk->fg_count[x] = chunk->mask[x] = 0;
+		chunk->fg_sum[0][x] = chunk->fg_sum[1][x] = chunk->fg_sum[2][x] = 0;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		for (size_t x = 0; x < cols; ++x) {
+			// above the mean is compared as value * n > sum, so nothing is divided
+			uint16_t r = chunk->channels[i][0][x], g = chunk->channels[i][1][x], b = chunk->channels[i][2][x];
+			uint16_t value = (uint16_t) (r * chunk->pick[0][x] + g * chunk->pick[1][x] + b * chunk->pick[2][x]);
+			uint16_t fg = value * n > chunk->threshold[x];
+			chunk->mask[x] |= (uint16_t) (fg << i);
+			chunk->fg_count[x] += fg;
+			chunk->fg_sum[0][x] += (uint16_t) (r * fg);
+			chunk->fg_sum[1][x] += (uint16_t) (g * fg);
+			chunk->fg_sum[2][x] += (uint16_t) (b * fg);
+		}
+	}
+
+	for (size_t x = 0; x < cols; ++x) {
+		// a side without pixels divides by 1 instead, its colour isn't shown
+		unsigned int fg_count = chunk->fg_count[x], bg_count = (unsigned int) n - fg_count;
+		unsigned int fg_div = fg_count + (fg_count == 0), bg_div = bg_count + (bg_count == 0);
+		uint8_t fg[3], bg[3];
+		for (int c = 0; c < 3; ++c) {
+			unsigned int fg_sum = chunk->fg_sum[c][x], bg_sum = chunk->sum[c][x] - fg_sum;
+			fg[c] = (uint8_t) ((fg_sum + fg_div / 2) / fg_div);
+			bg[c] = (uint8_t) ((bg_sum + bg_div / 2) / bg_div);
+		}
+		chunk->fg[x] = (struct color){{{fg[0], fg[1], fg[2], 0xff}}};
+		chunk->bg[x] = (struct color){{{bg[0], bg[1], bg[2], 0xff}}};
+	}
+}
+
+static void print_color(struct color color, bool fg, enum bit_depth bit_depth, struct palette *palette, FILE *fp) {
 	fprintf(fp, "\x1b[%c", fg ? '3' : '4');
 	switch (bit_depth) {
 		case BIT_4:
-			fprintf(fp, "8;5;%d", rgb_to_4bit(color));
+			fprintf(fp, "8;5;%d", palette ? palette_lookup(palette, color) : rgb_to_4bit(color));
 			break;
 		case BIT_8:
 			fprintf(fp, "8;5;%d", rgb_to_8bit(color));
@@ -32,67 +178,181 @@ static void print_color(struct color color, bool fg, enum bit_depth bit_depth, F
 	fprintf(fp, "m");
 }
 
-static void move_cursor(struct position position) {
-	fprintf(stdout, "\x1b[%d;%dH", position.y + 1, position.x + 1);
+static void move_cursor(struct position position, FILE *fp) {
+	fprintf(fp, "\x1b[%d;%dH", position.y + 1, position.x + 1);
+}
+
+static bool parse_osc_color(char *str, struct color *color) {
+	// parses the rgb:RRRR/GGGG/BBBB reply format, each channel can have 1-4 hex digits
+	if (strncmp(str, "rgb:", 4) != 0) return false;
+	str += 4;
+	uint8_t channels[3];
+	for (int i = 0; i < 3; ++i) {
+		char *end;
+		unsigned long value = strtoul(str, &end, 16);
+		int digits = (int) (end - str);
+		if (digits < 1 || digits > 4) return false;
+		if (*end != (i < 2 ? '/' : '\0')) return false;
+		// scale to 8 bits
+		channels[i] = (uint8_t) (value * 255 / ((1ul << (digits * 4)) - 1));
+		str = end + 1;
+	}
+	*color = (struct color){{{channels[0], channels[1], channels[2], 0xff}}};
+	return true;
+}
+
+static bool is_da1_reply(char *str) {
+	// \x1b[?<params>c, sent by every terminal in reply to \x1b[c
+	if (strncmp(str, "\x1b[?", 3) != 0) return false;
+	for (str += 3; (*str >= '0' && *str <= '9') || *str == ';'; ++str);
+	return *str == 'c';
+}
+
+bool query_term_palette(struct palette *palette, struct color *background, bool *background_set) {
+	// ask the terminal for its actual colors with OSC 4 (palette) and OSC 11 (background)
+	int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+	if (fd < 0) return false;
+
+	struct termios old_termios, raw_termios;
+	if (tcgetattr(fd, &old_termios) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// disable line buffering and echo so the replies can be read immediately
+	raw_termios = old_termios;
+	raw_termios.c_lflag &= ~(ICANON | ECHO);
+	raw_termios.c_cc[VMIN] = 0;
+	raw_termios.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &raw_termios) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// terminals without OSC support stay silent, so end with a device attributes request
+	// which is always answered, instead of waiting for the whole timeout
+	char request[512];
+	int request_len = 0;
+	for (int i = 0; i < 16; ++i)
+		request_len += snprintf(request + request_len, sizeof(request) - request_len, "\x1b]4;%d;?\x1b\\", i);
+	request_len += snprintf(request + request_len, sizeof(request) - request_len, "\x1b]11;?\x1b\\\x1b[c");
+
+	char reply[4096];
+	size_t reply_len = 0;
+	if (write(fd, request, request_len) == request_len) {
+		unsigned long long deadline = get_time() + QUERY_TIMEOUT;
+		bool done = false;
+		while (!done && reply_len < sizeof(reply) - 1) {
+			unsigned long long now = get_time();
+			if (now >= deadline) break;
+
+			struct pollfd pfd = {.fd = fd, .events = POLLIN};
+			if (poll(&pfd, 1, (int) (deadline - now)) <= 0) break;
+
+			ssize_t n = read(fd, reply + reply_len, sizeof(reply) - 1 - reply_len);
+			if (n <= 0) break;
+			reply_len += n;
+			reply[reply_len] = '\0';
+
+			// look for the device attributes reply
+			for (char *p = strchr(reply, '\x1b'); p && !done; p = strchr(p + 1, '\x1b'))
+				done = is_da1_reply(p);
+		}
+	}
+	reply[reply_len] = '\0';
+
+	tcsetattr(fd, TCSANOW, &old_termios);
+	close(fd);
+
+	// parse each \x1b]<code>;...<BEL or ST> reply
+	bool found = false;
+	for (char *p = strstr(reply, "\x1b]"); p; p = strstr(p, "\x1b]")) {
+		p += 2;
+		char *end = p + strcspn(p, "\a\x1b");
+		char terminator = *end;
+		*end = '\0';
+
+		char *endptr;
+		long code = strtol(p, &endptr, 10);
+		struct color color;
+		if (*endptr == ';') {
+			if (code == 4) {
+				long index = strtol(endptr + 1, &endptr, 10);
+				if (*endptr == ';' && index >= 0 && index < 16 && parse_osc_color(endptr + 1, &color)) {
+					palette->colors[index] = color;
+					found = true;
+				}
+			} else if (code == 11 && background && parse_osc_color(endptr + 1, &color)) {
+				*background = color;
+				if (background_set) *background_set = true;
+				found = true;
+			}
+		}
+
+		if (!terminator) break;
+		p = end + 1;
+	}
+
+	return found;
 }
 
-enum render_callback render_image_to_terminal(SDL_Surface *surface, bool unicode, enum bit_depth bit_depth, FILE *fp, bool (*callback)()) {
+enum render_callback render_image_to_terminal(SDL_Surface *surface, enum glyph_mode glyphs, enum bit_depth bit_depth, struct palette *palette, bool position_cursor, FILE *fp, bool (*callback)()) {
 	enum render_callback ret = FAIL;
 	// lock surface
 	if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0) return FAIL;
 
-	if (surface->format->BitsPerPixel != TERM_DEPTH) goto end;
+	if (surface->format->BitsPerPixel != TERM_DEPTH || surface->format->Rmask != TERM_R_MASK || surface->format->Gmask != TERM_G_MASK || surface->format->Bmask != TERM_B_MASK) goto end;
 	if (surface->h <= 0 || surface->w <= 0) goto end;
 
-	// print each pixel
-	struct position c;
-	unsigned int y_mul = unicode ? 2u : 1u;
+	SDL_Point cell = glyph_cell_size(glyphs);
+	const char *const *table = glyph_modes[glyphs].table;
+	unsigned int cols = (unsigned int) (surface->w + cell.x - 1) / cell.x;
+	struct cell_chunk chunk;
 
-	for (c.y = 0; c.y < (unsigned int) surface->h; c.y += y_mul) {
+	for (unsigned int y = 0; y * cell.y < (unsigned int) surface->h; ++y) {
 		struct color col_bg_old, col_fg_old;
-		bool bg_set = false;
-		for (c.x = 0; c.x < (unsigned int) surface->w; ++c.x) {
+		bool fg_set = false;
+		for (unsigned int x = 0; x < cols; ++x) {
+			// fit a run of cells at once, then print each
+			unsigned int i = x % CELL_CHUNK;
+			if (i == 0) {
+				load_cell_chunk(&chunk, surface, cell, (int) x, (int) y * cell.y);
+				fit_cell_chunk(&chunk);
+			}
+
 			// check if we should stop
 			if (callback && !callback()) {
 				ret = ABORT;
 				goto end;
 			}
 
-			struct position term_pos = {.x = c.x, .y = c.y / y_mul};
-
-			// get pixel color(s)
-			struct color col_bg, col_fg;
-			if (!get_pixel(surface, c, &col_bg)) goto end;
-			if (unicode) {
-				if (c.y + 1 >= (unsigned int) surface->h) col_fg = col_bg; // out of bounds
-				if (!get_pixel(surface, (struct position){.x = c.x, .y = c.y + 1}, &col_fg)) goto end;
-			}
-
 			// set cursor for first column, the cursor is moved automatically by the terminal for the next columns
-			if (c.x == 0) {
-				move_cursor(term_pos);
+			if (x == 0 && position_cursor) {
+				move_cursor((struct position){.x = 0, .y = y}, fp);
 			}
 
 			// update bg color if last color was different
-			if (c.x == 0 || col_bg.u32 != col_bg_old.u32) {
+			struct color col_bg = chunk.bg[i], col_fg = chunk.fg[i];
+			if (x == 0 || col_bg.u32 != col_bg_old.u32) {
 				col_bg_old = col_bg;
-				print_color(col_bg, false, bit_depth, fp);
+				print_color(col_bg, false, bit_depth, palette, fp);
 			}
 
-			// print unicode block
-			if (unicode && col_bg.u32 != col_fg.u32) { // save bandwidth
+			// print the block, cells of a single colour are spaces to save bandwidth
+			if (chunk.mask[i]) {
 				// update fg color if last color was different
-				if (!bg_set || col_fg.u32 != col_fg_old.u32) {
-					bg_set = true;
+				if (!fg_set || col_fg.u32 != col_fg_old.u32) {
+					fg_set = true;
 					col_fg_old = col_fg;
-					print_color(col_fg, true, bit_depth, fp);
+					print_color(col_fg, true, bit_depth, palette, fp);
 				}
-				fprintf(fp, "\u2584"); // lower half block
+				fputs(table[chunk.mask[i]], fp);
 			} else {
-				fprintf(fp, " ");
+				fputc(' ', fp);
 			}
 		}
 		fprintf(fp, "\x1b[0m");
+		if (!position_cursor) fprintf(fp, "\n"); // rows are separated by newlines instead
 	}
 
 	ret = SUCCESS;
@@ -104,3 +364,84 @@ end:
 	}
 	return ret;
 }
+
+static size_t frame_bound(SDL_Surface *surface, enum glyph_mode glyphs) {
+	// the most bytes a frame can take: both colors as 24-bit escapes and the longest glyph in every cell,
+	// and moving the cursor and resetting the colors on every row
+	SDL_Point cell = glyph_cell_size(glyphs);
+	size_t cells = (size_t) surface->w / cell.x + 1, rows = (size_t) surface->h / cell.y + 1;
+	return rows * (cells * (2 * sizeof("\x1b[48;2;255;255;255m") + sizeof("\U0001FB00")) + 2 * sizeof("\x1b[4294967295;4294967295H\x1b[0m")) + 64;
+}
+
+enum render_callback render_frame(struct frame_buffer *buffer, SDL_Surface *surface, enum glyph_mode glyphs, enum bit_depth bit_depth, struct palette *palette, FILE *out, bool (*callback)()) {
+	// encodes the whole frame before writing any of it, so a frame that is cancelled never shows up half drawn
+	size_t bound = frame_bound(surface, glyphs);
+	if (bound > buffer->size) {
+		// only grows, so it ends up the size of the largest terminal seen
+		char *data = realloc(buffer->data, bound);
+		if (!data) {
+			warn("realloc");
+			return FAIL;
+		}
+		buffer->data = data;
+		buffer->size = bound;
+	}
+
+	FILE *fp = fmemopen(buffer->data, buffer->size, "w");
+	if (!fp) {
+		warn("fmemopen");
+		return FAIL;
+	}
+	enum render_callback ret = render_image_to_terminal(surface, glyphs, bit_depth, palette, true, fp, callback);
+	long len = ftell(fp);
+	if (ferror(fp) || len < 0) ret = FAIL;
+	fclose(fp);
+
+	if (ret == SUCCESS) {
+		if (fwrite(buffer->data, 1, (size_t) len, out) != (size_t) len) ret = FAIL;
+		fflush(out);
+	}
+	return ret;
+}
+
+void free_frame_buffer(struct frame_buffer *buffer) {
+	free(buffer->data);
+	*buffer = (struct frame_buffer){0};
+}
+
+bool render_surface(SDL_Surface *surface, struct render_options *options, FILE *fp) {
+	// lays the image out the same way as the interactive terminal mode, then encodes it, without a terminal
+	bool ret = false;
+	SDL_Point cell = glyph_cell_size(options->glyphs);
+	SDL_Surface *term_surface = SDL_CreateRGBSurface(0, options->size.x * cell.x, options->size.y * cell.y, TERM_DEPTH, TERM_R_MASK, TERM_G_MASK, TERM_B_MASK, TERM_A_MASK);
+	if (!term_surface) {
+		eprintf("Failed to create terminal surface: %s\n", SDL_GetError());
+		return false;
+	}
+
+	SDL_Rect rect;
+	if (options->stretch) {
+		rect = (SDL_Rect){.x = 0, .y = 0, .w = term_surface->w, .h = term_surface->h};
+	} else {
+		SDL_Point size = oriented_size((SDL_Point){surface->w, surface->h}, surface_orientation(surface));
+		rect = get_fit_mode(glyph_fit_size(size, options->glyphs), (SDL_Point){term_surface->w, term_surface->h});
+	}
+
+	SDL_FillRect(term_surface, NULL, SDL_MapRGBA(term_surface->format, options->background.r, options->background.g, options->background.b, 255));
+	if (rect.w > 0 && rect.h > 0) {
+		SDL_Surface *upright = scale_upright(surface, rect.w, rect.h);
+		if (!upright) {
+			eprintf("Failed to scale image\n");
+			goto end;
+		}
+		SDL_SetSurfaceBlendMode(upright, SDL_BLENDMODE_BLEND);
+		SDL_BlitSurface(upright, NULL, term_surface, &rect);
+		SDL_FreeSurface(upright);
+	}
+
+	ret = render_image_to_terminal(term_surface, options->glyphs, options->bit_depth, options->palette, false, fp, NULL) == SUCCESS;
+
+end:
+	SDL_FreeSurface(term_surface);
+	return ret;
+}
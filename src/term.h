@@ -1,6 +1,7 @@
 #ifndef TERM_H
 #define TERM_H
 #include <stdbool.h>
+#include <stdio.h>
 #include <SDL2/SDL.h>
 #include "color.h"
 
@@ -17,6 +18,17 @@ enum bit_depth {
 	BIT_24
 };
 
+// the block characters cells are drawn with, which decides how many pixels a cell shows
+enum glyph_mode {
+	GLYPH_SPACE = 0, // 1x1, only the background colour
+	GLYPH_HALF,      // 1x2, with half blocks
+	GLYPH_QUADRANT,  // 2x2, with quadrant blocks
+	GLYPH_SEXTANT    // 2x3, with the sextants added in Unicode 13
+};
+
+// the most pixels a cell can have
+#define GLYPH_MAX_PIXELS (6)
+
 struct position {
 	unsigned int x, y;
 };
@@ -26,5 +38,31 @@ enum render_callback {
 	SUCCESS,
 	ABORT
 };
-enum render_callback render_image_to_terminal(SDL_Surface *surface, bool unicode, enum bit_depth bit_depth, FILE *fp, bool (*callback)());
+// everything needed to render an image without a terminal
+struct render_options {
+	SDL_Point size; // in cells
+	SDL_Color background;
+	enum glyph_mode glyphs;
+	bool stretch;
+	enum bit_depth bit_depth;
+	struct palette *palette;
+};
+
+// reused between frames, so encoding doesn't allocate once it is big enough
+struct frame_buffer {
+	char *data;
+	size_t size;
+};
+
+// how long to wait for the terminal to answer color queries, in ms
+#define QUERY_TIMEOUT (200)
+
+bool parse_glyph_mode(const char *str, enum glyph_mode *glyphs);
+SDL_Point glyph_cell_size(enum glyph_mode glyphs);
+SDL_Point glyph_fit_size(SDL_Point size, enum glyph_mode glyphs);
+bool query_term_palette(struct palette *palette, struct color *background, bool *background_set);
+enum render_callback render_image_to_terminal(SDL_Surface *surface, enum glyph_mode glyphs, enum bit_depth bit_depth, struct palette *palette, bool position_cursor, FILE *fp, bool (*callback)());
+enum render_callback render_frame(struct frame_buffer *buffer, SDL_Surface *surface, enum glyph_mode glyphs, enum bit_depth bit_depth, struct palette *palette, FILE *out, bool (*callback)());
+void free_frame_buffer(struct frame_buffer *buffer);
+bool render_surface(SDL_Surface *surface, struct render_options *options, FILE *fp);
 #endif // TERM_H
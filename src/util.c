@@ -39,6 +39,11 @@ SDL_Rect get_fit_mode(SDL_Point image_size_, SDL_Point window_size_) {
 	}
 }
 
+size_t surface_size(SDL_Surface *surface) {
+	// bytes used by the pixels of a surface
+	return (size_t) surface->pitch * (size_t) surface->h;
+}
+
 struct lconv *get_lconv() {
 	static struct lconv *lconv = NULL;
 	if (!lconv) lconv = localeconv();
@@ -6,5 +6,6 @@
 
 unsigned long long get_time();
 SDL_Rect get_fit_mode(SDL_Point image_size_, SDL_Point window_size_);
+size_t surface_size(SDL_Surface *surface);
 struct lconv *get_lconv();
 char *str_fallback(char *str, char *fallback);
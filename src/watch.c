@@ -0,0 +1,204 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "util.h"
+
+// interval to stat files at when inotify is unavailable, in ms
+#define POLL_INTERVAL (1000)
+
+// longest that writes can keep putting off a reload, in multiples of the debounce time
+#define DEBOUNCE_LIMIT (20)
+
+#define DIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY | IN_ATTRIB)
+#define FILE_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB)
+
+bool watch_init(struct watch *watch, unsigned int debounce) {
+	*watch = (struct watch){.fd = -1, .stop_pipe = {-1, -1}, .debounce = debounce};
+
+	if (pipe(watch->stop_pipe) != 0) {
+		warn("pipe");
+		return false;
+	}
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0) warn("inotify, falling back to polling");
+	return true;
+}
+
+static bool has_changed(struct watch_file *file) {
+	// compare everything an edit or a replacement could change, mtime alone only has a resolution of a second on some filesystems
+	struct stat st;
+	if (stat(file->path, &st) != 0) return false; // replaced file is not there yet
+	bool changed = st.st_mtim.tv_sec != file->st.st_mtim.tv_sec ||
+	               st.st_mtim.tv_nsec != file->st.st_mtim.tv_nsec ||
+	               st.st_size != file->st.st_size ||
+	               st.st_ino != file->st.st_ino ||
+	               st.st_dev != file->st.st_dev;
+	file->st = st;
+	return changed;
+}
+
+static void add_file_watch(struct watch *watch, struct watch_file *file) {
+	// watches the file itself as well, this follows symlinks, the directory does not
+	// has to be added again after the file has been replaced, as it watches the old inode
+	if (watch->fd < 0) return;
+	file->file_wd = inotify_add_watch(watch->fd, file->path, FILE_EVENTS);
+}
+
+bool watch_add(struct watch *watch, char *path) {
+	struct watch_file *files = realloc(watch->files, sizeof(struct watch_file) * (watch->count + 1));
+	if (!files) {
+		warn("realloc");
+		return false;
+	}
+	watch->files = files;
+
+	struct watch_file *file = &files[watch->count];
+	*file = (struct watch_file){.path = path, .dir_wd = -1, .file_wd = -1};
+
+	char *slash = strrchr(path, '/');
+	file->name = slash ? slash + 1 : path;
+
+	if (stat(path, &file->st) != 0) {
+		warn("hot-reload: %s", path);
+		return false;
+	}
+
+	if (watch->fd >= 0) {
+		// watch the directory so atomic saves (write a new file, then rename it over the old one) are seen
+		char dir[PATH_MAX];
+		if (!slash) strcpy(dir, ".");
+		else if (slash == path) strcpy(dir, "/");
+		else
+			snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+
+		file->dir_wd = inotify_add_watch(watch->fd, dir, DIR_EVENTS);
+		if (file->dir_wd < 0) {
+			warn("hot-reload: %s", dir);
+			return false;
+		}
+		add_file_watch(watch, file);
+	}
+
+	++watch->count;
+	return true;
+}
+
+static bool read_events(struct watch *watch) {
+	// mark files with events as pending, returns false if nothing was read
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool any = false;
+	for (;;) {
+		ssize_t len = read(watch->fd, buf, sizeof(buf));
+		if (len <= 0) break;
+		for (char *p = buf; p < buf + len;) {
+			struct inotify_event *event = (struct inotify_event *) p;
+			for (size_t i = 0; i < watch->count; ++i) {
+				struct watch_file *file = &watch->files[i];
+				if ((event->wd == file->file_wd) ||
+				    (event->wd == file->dir_wd && event->len && strcmp(event->name, file->name) == 0)) {
+					file->pending = true;
+					any = true;
+				}
+			}
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return any;
+}
+
+static bool wait_settled(struct watch *watch, struct pollfd *fds) {
+	// wait for writes to settle, a save is often several writes or a write followed by a rename
+	// only events for the watched files start it again, and only up to a limit, false if the thread was stopped
+	Uint32 now = SDL_GetTicks();
+	Uint32 limit = now + watch->debounce * DEBOUNCE_LIMIT;
+	Uint32 settled = now + watch->debounce;
+	while (!SDL_TICKS_PASSED(now, settled)) {
+		int ret = poll(fds, 2, (int) (settled - now));
+		if (ret < 0 && errno != EINTR) {
+			warn("poll");
+			return true;
+		}
+		if (ret > 0 && fds[0].revents) return false;
+		now = SDL_GetTicks();
+		if (ret > 0 && read_events(watch)) settled = SDL_TICKS_PASSED(now + watch->debounce, limit) ? limit : now + watch->debounce;
+	}
+	return true;
+}
+
+static void notify(struct watch *watch, size_t index) {
+	SDL_Event event = {0};
+	event.type = watch->event_type;
+	event.user.code = (Sint32) index;
+	SDL_PushEvent(&event);
+}
+
+static int watch_thread(void *data) {
+	struct watch *watch = data;
+	struct pollfd fds[2] = {
+	        {.fd = watch->stop_pipe[0], .events = POLLIN},
+	        {.fd = watch->fd,           .events = POLLIN},
+	};
+	nfds_t nfds = watch->fd >= 0 ? 2 : 1;
+
+	for (;;) {
+		// sleeps until something happens, unless files have to be polled
+		int ret = poll(fds, nfds, watch->fd >= 0 ? -1 : POLL_INTERVAL);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			warn("poll");
+			break;
+		}
+		if (fds[0].revents) break; // stopped
+
+		if (watch->fd >= 0) {
+			if (!read_events(watch)) continue;
+			if (!wait_settled(watch, fds)) break;
+		} else {
+			for (size_t i = 0; i < watch->count; ++i) watch->files[i].pending = true;
+		}
+
+		for (size_t i = 0; i < watch->count; ++i) {
+			struct watch_file *file = &watch->files[i];
+			if (!file->pending) continue;
+			file->pending = false;
+
+			ino_t old_ino = file->st.st_ino;
+			if (has_changed(file)) {
+				if (file->st.st_ino != old_ino) add_file_watch(watch, file);
+				notify(watch, i);
+			}
+		}
+	}
+	return 0;
+}
+
+bool watch_start(struct watch *watch, Uint32 event_type) {
+	watch->event_type = event_type;
+	watch->thread = SDL_CreateThread(watch_thread, "watch", watch);
+	if (!watch->thread) {
+		eprintf("Failed to create thread: %s\n", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+void watch_free(struct watch *watch) {
+	if (watch->thread) {
+		// wake the thread up so it can exit
+		if (write(watch->stop_pipe[1], "", 1) == 1) SDL_WaitThread(watch->thread, NULL);
+		watch->thread = NULL;
+	}
+	if (watch->fd >= 0) close(watch->fd);
+	if (watch->stop_pipe[0] >= 0) close(watch->stop_pipe[0]);
+	if (watch->stop_pipe[1] >= 0) close(watch->stop_pipe[1]);
+	free(watch->files);
+	*watch = (struct watch){.fd = -1, .stop_pipe = {-1, -1}};
+}
@@ -0,0 +1,31 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+
+// default time to wait for writes to settle before reloading, in ms
+#define DEBOUNCE_DEFAULT (50)
+
+struct watch_file {
+	char *path, *name; // name is the last component of path
+	int dir_wd, file_wd;
+	struct stat st; // last seen state of the file
+	bool pending;
+};
+
+struct watch {
+	int fd;        // inotify, -1 if unavailable and files are polled instead
+	int stop_pipe[2];
+	unsigned int debounce;
+	struct watch_file *files;
+	size_t count;
+	Uint32 event_type;
+	SDL_Thread *thread;
+};
+
+bool watch_init(struct watch *watch, unsigned int debounce);
+bool watch_add(struct watch *watch, char *path);
+bool watch_start(struct watch *watch, Uint32 event_type);
+void watch_free(struct watch *watch);
+#endif // WATCH_H
@@ -0,0 +1,113 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yuv.h"
+#include "image.h"
+#include "region.h"
+#include "util.h"
+
+#ifdef HAVE_LIBJPEG
+static bool decode_jpeg_yuv(const uint8_t *data, size_t size, struct yuv_image *image) {
+	// skips the color conversion and chroma upsampling in libjpeg, only works for 4:2:0 like most photos
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error error;
+	*image = (struct yuv_image){0};
+
+	cinfo.err = jpeg_quiet_error(&error);
+	if (setjmp(error.jmp)) {
+		free_yuv(image);
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, data, (unsigned long) size);
+	jpeg_read_header(&cinfo, TRUE);
+
+	jpeg_component_info *comp = cinfo.comp_info;
+	if (cinfo.num_components != 3 || cinfo.jpeg_color_space != JCS_YCbCr ||
+	    comp[0].h_samp_factor != 2 || comp[0].v_samp_factor != 2 ||
+	    comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 ||
+	    comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	cinfo.raw_data_out = TRUE;
+	cinfo.do_fancy_upsampling = FALSE;
+	cinfo.out_color_space = JCS_YCbCr;
+	jpeg_start_decompress(&cinfo);
+
+	// each call outputs one row of MCUs, 16 luma rows and 8 chroma rows, which may go past the image
+	int mcu_rows = (int) ((cinfo.output_height + 2 * DCTSIZE - 1) / (2 * DCTSIZE));
+	image->w = (int) cinfo.output_width;
+	image->h = (int) cinfo.output_height;
+	for (int c = 0; c < 3; ++c) {
+		int rows = mcu_rows * comp[c].v_samp_factor * DCTSIZE;
+		image->pitches[c] = (int) comp[c].width_in_blocks * DCTSIZE;
+		// the decoder writes whole blocks, so pad each row to one
+		if (image->pitches[c] < (c == 0 ? image->w : (image->w + 1) / 2)) longjmp(error.jmp, 1);
+		image->planes[c] = malloc((size_t) image->pitches[c] * rows);
+		if (!image->planes[c]) longjmp(error.jmp, 1);
+	}
+
+	JSAMPROW y_rows[2 * DCTSIZE], u_rows[DCTSIZE], v_rows[DCTSIZE];
+	JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+	for (int mcu = 0; mcu < mcu_rows; ++mcu) {
+		for (int i = 0; i < 2 * DCTSIZE; ++i)
+			y_rows[i] = image->planes[0] + (size_t) (mcu * 2 * DCTSIZE + i) * image->pitches[0];
+		for (int i = 0; i < DCTSIZE; ++i) {
+			u_rows[i] = image->planes[1] + (size_t) (mcu * DCTSIZE + i) * image->pitches[1];
+			v_rows[i] = image->planes[2] + (size_t) (mcu * DCTSIZE + i) * image->pitches[2];
+		}
+		if (jpeg_read_raw_data(&cinfo, planes, 2 * DCTSIZE) == 0) longjmp(error.jmp, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	image->orientation = exif_orientation(data, size);
+	return true;
+}
+#endif
+
+bool load_yuv(char *filename, struct yuv_image *image) {
+	// false if the image isn't a 4:2:0 jpeg, so it should be loaded as usual
+#ifdef HAVE_LIBJPEG
+	FILE *fp = open_file(filename);
+	if (!fp) return false;
+	size_t size;
+	uint8_t *data = read_bytes(fp, &size);
+	close_file(fp);
+	if (!data) return false;
+
+	bool ret = size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff && decode_jpeg_yuv(data, size, image);
+	free(data);
+	return ret;
+#else
+	(void) filename;
+	(void) image;
+	return false;
+#endif
+}
+
+SDL_Texture *yuv_texture(SDL_Renderer *renderer, struct yuv_image *image) {
+	// the renderer converts the colors, on the gpu when it has one
+	// jpeg uses the full range bt.601 matrix, whatever the size of the image
+	SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
+	SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STATIC, image->w, image->h);
+	if (!texture) return NULL;
+	if (SDL_UpdateYUVTexture(texture, NULL, image->planes[0], image->pitches[0], image->planes[1], image->pitches[1], image->planes[2], image->pitches[2]) != 0) {
+		SDL_DestroyTexture(texture);
+		return NULL;
+	}
+	return texture;
+}
+
+void free_yuv(struct yuv_image *image) {
+	for (int c = 0; c < 3; ++c) {
+		free(image->planes[c]);
+		image->planes[c] = NULL;
+	}
+}
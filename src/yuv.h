@@ -0,0 +1,19 @@
+#ifndef YUV_H
+#define YUV_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "exif.h"
+
+// a 4:2:0 image as three planes, the way the decoder outputs it, for SDL_PIXELFORMAT_IYUV textures
+struct yuv_image {
+	int w, h;
+	uint8_t *planes[3]; // y, u, v
+	int pitches[3];
+	enum orientation orientation;
+};
+
+bool load_yuv(char *filename, struct yuv_image *image);
+SDL_Texture *yuv_texture(SDL_Renderer *renderer, struct yuv_image *image);
+void free_yuv(struct yuv_image *image);
+#endif // YUV_H
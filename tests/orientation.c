@@ -0,0 +1,98 @@
+// draws a 3x2 image in every orientation through draw_oriented with the software renderer, and through orient_surface,
+// and checks where each pixel ends up, it isn't square so the width and height have to be swapped for half of them
+#include <stdio.h>
+#include <SDL2/SDL.h>
+
+#include "image.h"
+
+#define W (3)
+#define H (2)
+// drawn away from the corner of a larger target, so a misplaced image shows up as pixels outside of its rect
+#define TARGET (5)
+#define OFFSET (1)
+
+static const Uint32 pixels[W * H] = {0xffff0000, 0xff00ff00, 0xff0000ff, 0xffffff00, 0xff00ffff, 0xffffffff};
+static const Uint32 background = 0xff000000;
+
+// the source pixel at each pixel of the upright image, row by row
+static const int expected[][W * H] = {
+        [ORIENTATION_NORMAL]     = {0, 1, 2, 3, 4, 5},
+        [ORIENTATION_FLIP_H]     = {2, 1, 0, 5, 4, 3},
+        [ORIENTATION_ROTATE_180] = {5, 4, 3, 2, 1, 0},
+        [ORIENTATION_FLIP_V]     = {3, 4, 5, 0, 1, 2},
+        [ORIENTATION_TRANSPOSE]  = {0, 3, 1, 4, 2, 5},
+        [ORIENTATION_ROTATE_90]  = {3, 0, 4, 1, 5, 2},
+        [ORIENTATION_TRANSVERSE] = {5, 2, 4, 1, 3, 0},
+        [ORIENTATION_ROTATE_270] = {2, 5, 1, 4, 0, 3},
+};
+
+static Uint32 get_pixel(SDL_Surface *surface, int x, int y) {
+	return ((Uint32 *) ((Uint8 *) surface->pixels + y * surface->pitch))[x];
+}
+
+static bool check_drawn(SDL_Renderer *renderer, SDL_Surface *target, SDL_Texture *texture, enum orientation orientation) {
+	SDL_Point size = oriented_size((SDL_Point){W, H}, orientation);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+	if (draw_oriented(renderer, texture, (SDL_Rect){OFFSET, OFFSET, size.x, size.y}, orientation) != 0) {
+		fprintf(stderr, "draw %d: %s\n", orientation, SDL_GetError());
+		return false;
+	}
+	SDL_RenderPresent(renderer);
+
+	bool ok = true;
+	for (int y = 0; y < TARGET; ++y) {
+		for (int x = 0; x < TARGET; ++x) {
+			int ix = x - OFFSET, iy = y - OFFSET;
+			bool inside = ix >= 0 && iy >= 0 && ix < size.x && iy < size.y;
+			Uint32 want = inside ? pixels[expected[orientation][iy * size.x + ix]] : background;
+			Uint32 got = get_pixel(target, x, y);
+			if (got != want) {
+				fprintf(stderr, "draw %d: pixel %d,%d is %08x, expected %08x\n", orientation, x, y, got, want);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+static bool check_oriented(SDL_Surface *image, enum orientation orientation) {
+	SDL_Point size = oriented_size((SDL_Point){W, H}, orientation);
+	SDL_Surface *upright = orient_surface(image, orientation);
+	if (!upright) return false;
+
+	bool ok = upright->w == size.x && upright->h == size.y;
+	if (!ok) fprintf(stderr, "orient %d: size is %dx%d, expected %dx%d\n", orientation, upright->w, upright->h, size.x, size.y);
+	for (int i = 0; ok && i < W * H; ++i) {
+		Uint32 got = get_pixel(upright, i % size.x, i / size.x);
+		if (got != pixels[expected[orientation][i]]) {
+			fprintf(stderr, "orient %d: pixel %d is %08x, expected %08x\n", orientation, i, got, pixels[expected[orientation][i]]);
+			ok = false;
+		}
+	}
+	SDL_FreeSurface(upright);
+	return ok;
+}
+
+int main() {
+	SDL_Surface *image = SDL_CreateRGBSurfaceWithFormatFrom((void *) pixels, W, H, 32, W * 4, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, TARGET, TARGET, 32, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+	SDL_Texture *texture = renderer && image ? SDL_CreateTextureFromSurface(renderer, image) : NULL;
+	if (!texture) {
+		fprintf(stderr, "setup: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	bool ok = true;
+	for (enum orientation orientation = ORIENTATION_NORMAL; orientation <= ORIENTATION_ROTATE_270; ++orientation) {
+		ok = check_drawn(renderer, target, texture, orientation) && ok;
+		ok = check_oriented(image, orientation) && ok;
+	}
+
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(target);
+	SDL_FreeSurface(image);
+	return ok ? 0 : 1;
+}
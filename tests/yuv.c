@@ -0,0 +1,114 @@
+// encodes a small 4:2:0 jpeg, draws its yuv planes with the software renderer and checks them against the rgb decode
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+
+#include "image.h"
+#include "region.h"
+#include "yuv.h"
+
+// not a multiple of the 16x16 blocks, so the padding of the planes is covered too
+#define W (36)
+#define H (22)
+// the renderer doesn't smooth the chroma like libjpeg does, so only smooth colors are compared, within this much
+#define TOLERANCE (12)
+
+static bool write_jpeg(FILE *fp) {
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error error;
+	cinfo.err = jpeg_quiet_error(&error);
+	if (setjmp(error.jmp)) {
+		jpeg_destroy_compress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, fp);
+	cinfo.image_width = W;
+	cinfo.image_height = H;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo); // 2x2 luma to 1x1 chroma, which is 4:2:0
+	jpeg_set_quality(&cinfo, 95, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	JSAMPLE row[W * 3];
+	while (cinfo.next_scanline < H) {
+		int y = (int) cinfo.next_scanline;
+		for (int x = 0; x < W; ++x) {
+			row[x * 3] = (JSAMPLE) (x * 255 / (W - 1));
+			row[x * 3 + 1] = (JSAMPLE) (y * 255 / (H - 1));
+			row[x * 3 + 2] = 128;
+		}
+		JSAMPROW rows[1] = {row};
+		jpeg_write_scanlines(&cinfo, rows, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return true;
+}
+
+static bool compare(SDL_Surface *target, SDL_Surface *expected) {
+	bool ok = true;
+	for (int y = 0; y < H; ++y) {
+		Uint32 *got = (Uint32 *) ((Uint8 *) target->pixels + y * target->pitch);
+		Uint32 *want = (Uint32 *) ((Uint8 *) expected->pixels + y * expected->pitch);
+		for (int x = 0; x < W; ++x) {
+			for (int shift = 0; shift < 24; shift += 8) {
+				int diff = (int) (got[x] >> shift & 0xff) - (int) (want[x] >> shift & 0xff);
+				if (abs(diff) <= TOLERANCE) continue;
+				fprintf(stderr, "pixel %d,%d is %06x, expected %06x\n", x, y, got[x] & 0xffffff, want[x] & 0xffffff);
+				ok = false;
+				break;
+			}
+		}
+	}
+	return ok;
+}
+
+int main() {
+	char path[] = "/tmp/foto-yuv-XXXXXX";
+	int fd = mkstemp(path);
+	FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!fp) {
+		perror("mkstemp");
+		return 1;
+	}
+	bool written = write_jpeg(fp);
+	fclose(fp);
+
+	struct yuv_image yuv = {0};
+	struct load_options load = {.threads = 1};
+	bool decoded = written && load_yuv(path, &yuv);
+	SDL_Surface *rgb = decoded ? load_file(path, &load) : NULL;
+	unlink(path);
+	if (!rgb) {
+		fprintf(stderr, "decode failed\n");
+		free_yuv(&yuv);
+		return 1;
+	}
+
+	SDL_Surface *expected = SDL_ConvertSurfaceFormat(rgb, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, W, H, 32, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+	SDL_Texture *texture = renderer ? yuv_texture(renderer, &yuv) : NULL;
+	if (!expected || !texture) {
+		fprintf(stderr, "setup: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	bool ok = yuv.w == W && yuv.h == H;
+	if (!ok) fprintf(stderr, "size is %dx%d, expected %dx%d\n", yuv.w, yuv.h, W, H);
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+	ok = compare(target, expected) && ok;
+
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(target);
+	SDL_FreeSurface(expected);
+	free_surface(rgb);
+	free_yuv(&yuv);
+	return ok ? 0 : 1;
+}